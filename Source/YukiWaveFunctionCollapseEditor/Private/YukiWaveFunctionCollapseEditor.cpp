@@ -3,6 +3,9 @@
 #include "YukiWaveFunctionCollapseEditor.h"
 
 #include "AssetToolsModule.h"
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "UObject/ObjectSaveContext.h"
 
 #define LOCTEXT_NAMESPACE "FYukiWaveFunctionCollapseEditorModule"
 
@@ -10,10 +13,41 @@ static const FName NAME_MODULE_AssetTools(TEXT("AssetTools"));
 
 void FYukiWaveFunctionCollapseEditorModule::StartupModule()
 {
+	PreSaveHandle = FCoreUObjectDelegates::OnObjectPreSave.AddStatic(&FYukiWaveFunctionCollapseEditorModule::OnObjectPreSave);
 }
 
 void FYukiWaveFunctionCollapseEditorModule::ShutdownModule()
 {
+	FCoreUObjectDelegates::OnObjectPreSave.Remove(PreSaveHandle);
+}
+
+void FYukiWaveFunctionCollapseEditorModule::OnObjectPreSave(UObject* Object, FObjectPreSaveContext SaveContext)
+{
+	UYukiWaveFunctionCollapseModel* Model = Cast<UYukiWaveFunctionCollapseModel>(Object);
+	if (!Model)
+	{
+		return;
+	}
+	if (!Model->CompileRules())
+	{
+		// Contradictions are fatal for cooked content since runtime solvers no longer validate. Cooks that
+		// still have to go through pass -YukiWFCAllowContradictions to only log them.
+		if (SaveContext.IsCooking())
+		{
+			if (FParse::Param(FCommandLine::Get(), TEXT("YukiWFCAllowContradictions")))
+			{
+				UE_LOG(LogWFC, Error, TEXT("%s has rule contradictions, run Solve Contradictions on it."), *Model->GetPathName());
+			}
+			else
+			{
+				UE_LOG(LogWFC, Fatal, TEXT("%s has rule contradictions, run Solve Contradictions on it before cooking."), *Model->GetPathName());
+			}
+		}
+		else
+		{
+			UE_LOG(LogWFC, Warning, TEXT("%s has rule contradictions, run Solve Contradictions on it."), *Model->GetPathName());
+		}
+	}
 }
 
 #undef LOCTEXT_NAMESPACE
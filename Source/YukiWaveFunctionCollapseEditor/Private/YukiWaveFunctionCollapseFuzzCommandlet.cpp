@@ -0,0 +1,354 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseFuzzCommandlet.h"
+
+#include "NativeGameplayTags.h"
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "UObject/Package.h"
+#include "UObject/StrongObjectPtr.h"
+
+namespace YukiWaveFunctionCollapseFuzzCommandlet
+{
+	// Propagation as the solver did it before the compiled rules, on tag containers read straight from the
+	// model. Slow, but simple enough to trust. Borders match hierarchically with Filter, neighbor options
+	// exactly with FilterExact, as they always did.
+	struct FReferencePropagator
+	{
+		const UYukiWaveFunctionCollapseModel* Model = nullptr;
+		FIntVector Size;
+		TArray<FGameplayTagContainer> Cells;
+		bool bContradiction = false;
+
+		void Init(const UYukiWaveFunctionCollapseModel& InModel, const FIntVector& InSize)
+		{
+			Model = &InModel;
+			Size = InSize;
+			bContradiction = false;
+			FGameplayTagContainer AllTags;
+			for (const auto& Tile : Model->Tiles)
+			{
+				AllTags.AddTag(Tile.Key);
+			}
+			Cells.Init(AllTags, Size.X * Size.Y * Size.Z);
+
+			TArray<int> Changed;
+			for (int Cell = 0; Cell < Cells.Num(); Cell++)
+			{
+				for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Model->Topology))
+				{
+					int NeighborIndex;
+					const FGameplayTagContainer* Border = Model->Borders.Find(Direction);
+					if (!GetNeighborCell(Model->Topology, Size, Cell, Direction, NeighborIndex) && Border && Border->Num() > 0)
+					{
+						Cells[Cell] = Cells[Cell].Filter(*Border);
+						bContradiction |= Cells[Cell].IsEmpty();
+						Changed.AddUnique(Cell);
+					}
+				}
+			}
+			Propagate(MoveTemp(Changed));
+		}
+
+		bool Restrict(int Cell, const FGameplayTagContainer& Tags)
+		{
+			const FGameplayTagContainer Restricted = Cells[Cell].FilterExact(Tags);
+			if (Restricted.Num() != Cells[Cell].Num())
+			{
+				Cells[Cell] = Restricted;
+				bContradiction |= Restricted.IsEmpty();
+				Propagate({Cell});
+			}
+			return !bContradiction;
+		}
+
+		void Propagate(TArray<int> Stack)
+		{
+			while (Stack.Num() > 0 && !bContradiction)
+			{
+				const int Cell = Stack.Pop();
+				for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Model->Topology))
+				{
+					int NeighborIndex;
+					if (!GetNeighborCell(Model->Topology, Size, Cell, Direction, NeighborIndex))
+					{
+						continue;
+					}
+					FGameplayTagContainer Allowed;
+					for (const FGameplayTag& Tag : Cells[Cell])
+					{
+						if (const FGameplayTagContainer* Options = Model->Tiles[Tag].Options.Find(Direction))
+						{
+							Allowed.AppendTags(*Options);
+						}
+					}
+					const FGameplayTagContainer Filtered = Cells[NeighborIndex].FilterExact(Allowed);
+					if (Filtered.Num() == Cells[NeighborIndex].Num())
+					{
+						continue;
+					}
+					Cells[NeighborIndex] = Filtered;
+					if (Filtered.IsEmpty())
+					{
+						bContradiction = true;
+						return;
+					}
+					Stack.AddUnique(NeighborIndex);
+				}
+			}
+		}
+	};
+
+	int32 ParseInt(const FString& Params, const TCHAR* Name, int32 Default)
+	{
+		int32 Value = Default;
+		FParse::Value(*Params, Name, Value);
+		return Value;
+	}
+
+	// Random rules that are always mirrored, so every generated model is valid to solve. Tags are nested in
+	// groups whose parent tag is a tile too, so borders and options name parents of other tiles.
+	UYukiWaveFunctionCollapseModel* MakeRandomModel(FRandomStream& Random, TConstArrayView<FGameplayTag> Tags)
+	{
+		UYukiWaveFunctionCollapseModel* Model = NewObject<UYukiWaveFunctionCollapseModel>(GetTransientPackage(), NAME_None, RF_Transient);
+		Model->CellSize = 100;
+		Model->Topology = (EYukiWaveFunctionCollapseTopology) Random.RandRange(0, (int32) EYukiWaveFunctionCollapseTopology::HexPrism);
+		for (const FGameplayTag& Tag : Tags)
+		{
+			FYukiWaveFunctionCollapseTileModel Tile;
+			Tile.Options.Reset();
+			Tile.Weight = Random.FRandRange(0.1f, 4.0f);
+			Model->Tiles.Add(Tag, Tile);
+		}
+
+		const float Density = Random.FRandRange(0.15f, 0.9f);
+		for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Model->Topology))
+		{
+			const EYDWaveFunctionDirection OppositeDirection = GetOppositeDirection(Direction);
+			// Every pair of directions once, the opposite side is filled in with it.
+			if ((int) Direction > (int) OppositeDirection)
+			{
+				continue;
+			}
+			for (const FGameplayTag& A : Tags)
+			{
+				for (const FGameplayTag& B : Tags)
+				{
+					if (Random.FRand() < Density)
+					{
+						Model->Tiles[A].Options.FindOrAdd(Direction).AddTag(B);
+						Model->Tiles[B].Options.FindOrAdd(OppositeDirection).AddTag(A);
+					}
+				}
+			}
+			for (const EYDWaveFunctionDirection Side : {Direction, OppositeDirection})
+			{
+				if (Random.FRand() < 0.3f)
+				{
+					FGameplayTagContainer& Border = Model->Borders.Add(Side);
+					Border.AddTag(Tags[Random.RandRange(0, Tags.Num() - 1)]);
+					if (Random.FRand() < 0.5f)
+					{
+						// A parent tag allows every tile below it.
+						Border.AddTag(Tags[Random.RandRange(0, Tags.Num() - 1)].RequestDirectParent());
+					}
+					for (const FGameplayTag& Tag : Tags)
+					{
+						if (Random.FRand() < 0.5f)
+						{
+							Border.AddTag(Tag);
+						}
+					}
+				}
+			}
+		}
+		Model->CompileRules();
+		return Model;
+	}
+
+	// Returns the index of the first cell whose options differ, INDEX_NONE if the waves match.
+	int FindMismatch(const UYukiWaveFunctionCollapseSolver& Solver, const FReferencePropagator& Reference)
+	{
+		for (int Cell = 0; Cell < Reference.Cells.Num(); Cell++)
+		{
+			const FGameplayTagContainer Tags = Solver.GetTagsForIndex(Cell);
+			if (Tags.Num() != Reference.Cells[Cell].Num() || !Tags.HasAllExact(Reference.Cells[Cell]))
+			{
+				return Cell;
+			}
+		}
+		return INDEX_NONE;
+	}
+
+	// Returns the number of Options and Borders rules a solved grid breaks.
+	int CountViolations(const UYukiWaveFunctionCollapseSolver& Solver, const UYukiWaveFunctionCollapseModel& Model)
+	{
+		int NumViolations = 0;
+		for (int Cell = 0; Cell < Solver.NumCells(); Cell++)
+		{
+			const FGameplayTag Tag = Solver.GetCollapsedTag(Cell);
+			const FYukiWaveFunctionCollapseTileModel& Tile = Model.Tiles[Tag];
+			for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Model.Topology))
+			{
+				int NeighborIndex;
+				if (GetNeighborCell(Model.Topology, Solver.Size, Cell, Direction, NeighborIndex))
+				{
+					const FGameplayTagContainer* Options = Tile.Options.Find(Direction);
+					NumViolations += Options && Options->HasTagExact(Solver.GetCollapsedTag(NeighborIndex)) ? 0 : 1;
+				}
+				else if (const FGameplayTagContainer* Border = Model.Borders.Find(Direction))
+				{
+					NumViolations += Border->Num() == 0 || Tag.MatchesAny(*Border) ? 0 : 1;
+				}
+			}
+		}
+		return NumViolations;
+	}
+}
+
+UYukiWaveFunctionCollapseFuzzCommandlet::UYukiWaveFunctionCollapseFuzzCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UYukiWaveFunctionCollapseFuzzCommandlet::Main(const FString& Params)
+{
+	using namespace YukiWaveFunctionCollapseFuzzCommandlet;
+
+	const int32 Seed = ParseInt(Params, TEXT("Seed="), 0);
+	const int32 Iterations = ParseInt(Params, TEXT("Iterations="), 200);
+	const int32 MaxTiles = ParseInt(Params, TEXT("MaxTiles="), 96);
+	const int32 MaxSize = ParseInt(Params, TEXT("MaxSize="), 16);
+	const int32 Edits = ParseInt(Params, TEXT("Edits="), 32);
+	const int32 SolveSeeds = ParseInt(Params, TEXT("SolveSeeds="), 4);
+	if (Iterations <= 0 || MaxTiles <= 0 || MaxSize <= 0 || Edits < 0 || SolveSeeds < 0)
+	{
+		UE_LOG(LogWFC, Error, TEXT("Usage: -run=YukiWaveFunctionCollapseFuzz [-Seed=0] [-Iterations=200] [-MaxTiles=96] [-MaxSize=16] [-Edits=32] [-SolveSeeds=4]"));
+		return 1;
+	}
+
+	// Fuzz tiles need real tags. Registered the way UE_DEFINE_GAMEPLAY_TAG does it, and removed again with the commandlet.
+	// Every group of TilesPerGroup starts with the group tag itself, followed by tiles nested below it.
+	constexpr int32 TilesPerGroup = 8;
+	TArray<TUniquePtr<FNativeGameplayTag>> NativeTags;
+	TArray<FGameplayTag> AllTags;
+	for (int32 i = 0; i < MaxTiles; i++)
+	{
+		const int32 Group = i / TilesPerGroup;
+		const FName TagName(*(i % TilesPerGroup == 0
+			? FString::Printf(TEXT("WFC.Fuzz.Group%d"), Group)
+			: FString::Printf(TEXT("WFC.Fuzz.Group%d.Tile%03d"), Group, i)));
+		NativeTags.Emplace(MakeUnique<FNativeGameplayTag>(UE_PLUGIN_NAME, UE_MODULE_NAME, TagName, TEXT(""), ENativeGameplayTagToken::PRIVATE_USE_MACRO_INSTEAD));
+		AllTags.Add(NativeTags.Last()->GetTag());
+	}
+
+	FRandomStream Random(Seed);
+	int32 NumFailures = 0;
+	int32 NumEdits = 0;
+	int32 NumSolved = 0;
+	double SolverSeconds = 0.0;
+	double ReferenceSeconds = 0.0;
+	for (int32 Iteration = 0; Iteration < Iterations; Iteration++)
+	{
+		// Sizes past 64 tiles cover masks of more than one word.
+		const int32 NumTiles = Random.RandRange(1, MaxTiles);
+		TStrongObjectPtr<UYukiWaveFunctionCollapseModel> Model(MakeRandomModel(Random, MakeArrayView(AllTags.GetData(), NumTiles)));
+		const FIntVector Size(Random.RandRange(1, MaxSize), Random.RandRange(1, MaxSize), Random.RandRange(1, 3));
+		const FString Description = FString::Printf(TEXT("iteration %d (%d tiles, %s, %s)"), Iteration, NumTiles, *Size.ToString(), *UEnum::GetValueAsString(Model->Topology));
+
+		TStrongObjectPtr<UYukiWaveFunctionCollapseSolver> Solver(NewObject<UYukiWaveFunctionCollapseSolver>());
+		FReferencePropagator Reference;
+		double StartTime = FPlatformTime::Seconds();
+		Solver->Init(Model.Get(), Size, FRandomStream(Iteration));
+		SolverSeconds += FPlatformTime::Seconds() - StartTime;
+		StartTime = FPlatformTime::Seconds();
+		Reference.Init(*Model, Size);
+		ReferenceSeconds += FPlatformTime::Seconds() - StartTime;
+
+		const bool bInitialContradiction = Reference.bContradiction;
+		bool bFailed = Solver->HasContradiction() != Reference.bContradiction;
+		if (!bFailed && !Reference.bContradiction)
+		{
+			const int Mismatch = FindMismatch(*Solver, Reference);
+			if (Mismatch != INDEX_NONE)
+			{
+				UE_LOG(LogWFC, Error, TEXT("Initial waves differ at cell %d in %s."), Mismatch, *Description);
+				bFailed = true;
+			}
+		}
+		else if (bFailed)
+		{
+			UE_LOG(LogWFC, Error, TEXT("Only one initial wave has a contradiction in %s."), *Description);
+		}
+
+		// The same random restrictions on both, until the first contradiction. Without one the arc consistent
+		// wave does not depend on propagation order, so both have to match after every edit.
+		for (int32 Edit = 0; Edit < Edits && !bFailed && !Reference.bContradiction; Edit++)
+		{
+			const int Cell = Random.RandRange(0, Reference.Cells.Num() - 1);
+			const TArray<FGameplayTag> Options = Reference.Cells[Cell].GetGameplayTagArray();
+			FGameplayTagContainer Tags;
+			Tags.AddTag(Options[Random.RandRange(0, Options.Num() - 1)]);
+			if (Random.FRand() < 0.5f)
+			{
+				for (const FGameplayTag& Option : Options)
+				{
+					if (Random.FRand() < 0.5f)
+					{
+						Tags.AddTag(Option);
+					}
+				}
+			}
+
+			StartTime = FPlatformTime::Seconds();
+			const bool bSolverValid = Solver->RestrictCell(Cell, Tags);
+			SolverSeconds += FPlatformTime::Seconds() - StartTime;
+			StartTime = FPlatformTime::Seconds();
+			const bool bReferenceValid = Reference.Restrict(Cell, Tags);
+			ReferenceSeconds += FPlatformTime::Seconds() - StartTime;
+			NumEdits++;
+
+			if (bSolverValid != bReferenceValid)
+			{
+				UE_LOG(LogWFC, Error, TEXT("Only one wave has a contradiction after edit %d of %s."), Edit, *Description);
+				bFailed = true;
+			}
+			else if (bSolverValid)
+			{
+				const int Mismatch = FindMismatch(*Solver, Reference);
+				if (Mismatch != INDEX_NONE)
+				{
+					UE_LOG(LogWFC, Error, TEXT("Waves differ at cell %d after edit %d of %s."), Mismatch, Edit, *Description);
+					bFailed = true;
+				}
+			}
+		}
+
+		Solver->MaxRestarts = 8;
+		for (int32 SolveSeed = 0; SolveSeed < SolveSeeds && !bFailed && !bInitialContradiction; SolveSeed++)
+		{
+			Solver->Reset(SolveSeed);
+			Solver->SolveFully();
+			if (!Solver->IsSolved())
+			{
+				continue;
+			}
+			NumSolved++;
+			const int NumViolations = CountViolations(*Solver, *Model);
+			if (NumViolations > 0)
+			{
+				UE_LOG(LogWFC, Error, TEXT("Solve with seed %d breaks %d rules in %s."), SolveSeed, NumViolations, *Description);
+				bFailed = true;
+			}
+		}
+		NumFailures += bFailed ? 1 : 0;
+	}
+
+	UE_LOG(LogWFC, Display, TEXT("Fuzzed %d models with %d edits and %d solves, %d failed. Propagation took %.3fs in the solver and %.3fs in the reference, %.1fx faster."),
+		Iterations, NumEdits, NumSolved, NumFailures, SolverSeconds, ReferenceSeconds, ReferenceSeconds / FMath::Max(SolverSeconds, UE_SMALL_NUMBER));
+	return NumFailures > 0 ? 1 : 0;
+}
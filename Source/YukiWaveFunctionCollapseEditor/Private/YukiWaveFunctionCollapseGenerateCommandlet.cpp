@@ -0,0 +1,193 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseGenerateCommandlet.h"
+
+#include "YukiWaveFunctionCollapseBatchFile.h"
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Async/ParallelFor.h"
+#include "Misc/Paths.h"
+#include "UObject/StrongObjectPtr.h"
+
+#include <atomic>
+
+namespace YukiWaveFunctionCollapseGenerateCommandlet
+{
+	bool ParseSize(const FString& Params, FIntVector& OutSize)
+	{
+		FString SizeString;
+		if (!FParse::Value(*Params, TEXT("Size="), SizeString, false))
+		{
+			return false;
+		}
+		TArray<FString> Components;
+		SizeString.ParseIntoArray(Components, TEXT(","));
+		if (Components.Num() != 3)
+		{
+			return false;
+		}
+		OutSize = FIntVector(FCString::Atoi(*Components[0]), FCString::Atoi(*Components[1]), FCString::Atoi(*Components[2]));
+		return OutSize.X > 0 && OutSize.Y > 0 && OutSize.Z > 0;
+	}
+
+	// Parses -MinCount=Tag:N[,Tag:N...] into solver requirements. Returns false if a tag is unknown or a count is not positive.
+	bool ParseMinCounts(const FString& Params, TMap<FGameplayTag, int32>& OutMinCounts)
+	{
+		FString MinCountString;
+		if (!FParse::Value(*Params, TEXT("MinCount="), MinCountString, false))
+		{
+			return true;
+		}
+		TArray<FString> Entries;
+		MinCountString.ParseIntoArray(Entries, TEXT(","));
+		for (const FString& Entry : Entries)
+		{
+			FString TagName;
+			FString CountString;
+			if (!Entry.Split(TEXT(":"), &TagName, &CountString, ESearchCase::CaseSensitive, ESearchDir::FromEnd))
+			{
+				return false;
+			}
+			const FGameplayTag Tag = FGameplayTag::RequestGameplayTag(FName(*TagName), false);
+			const int32 Count = FCString::Atoi(*CountString);
+			if (!Tag.IsValid() || Count <= 0)
+			{
+				UE_LOG(LogWFC, Error, TEXT("Invalid requirement %s."), *Entry);
+				return false;
+			}
+			OutMinCounts.Add(Tag, Count);
+		}
+		return true;
+	}
+}
+
+UYukiWaveFunctionCollapseGenerateCommandlet::UYukiWaveFunctionCollapseGenerateCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UYukiWaveFunctionCollapseGenerateCommandlet::Main(const FString& Params)
+{
+	using namespace YukiWaveFunctionCollapseGenerateCommandlet;
+
+	FString ModelPath;
+	FString Output;
+	FIntVector Size;
+	int32 SeedStart = 0;
+	int32 SeedCount = 1;
+	int32 NumThreads = FPlatformMisc::NumberOfWorkerThreadsToSpawn();
+	int32 ChunkSize = 256;
+	// A seed that keeps contradicting must not hang the batch, it is recorded as failed instead.
+	int32 MaxRestarts = 8;
+	FParse::Value(*Params, TEXT("Model="), ModelPath);
+	FParse::Value(*Params, TEXT("Output="), Output);
+	FParse::Value(*Params, TEXT("SeedStart="), SeedStart);
+	FParse::Value(*Params, TEXT("SeedCount="), SeedCount);
+	FParse::Value(*Params, TEXT("Threads="), NumThreads);
+	FParse::Value(*Params, TEXT("ChunkSize="), ChunkSize);
+	FParse::Value(*Params, TEXT("MaxRestarts="), MaxRestarts);
+	// Seeds that can no longer reach a minimum count stop early and are written with the Rejected flag.
+	TMap<FGameplayTag, int32> MinCounts;
+	if (ModelPath.IsEmpty() || Output.IsEmpty() || !ParseSize(Params, Size) || SeedCount <= 0 || NumThreads <= 0 || ChunkSize <= 0 || MaxRestarts < -1
+		|| !ParseMinCounts(Params, MinCounts))
+	{
+		UE_LOG(LogWFC, Error, TEXT("Usage: -run=YukiWaveFunctionCollapseGenerate -Model=<ObjectPath> -Size=X,Y,Z -Output=<File> [-SeedStart=0] [-SeedCount=1] [-Threads=N] [-ChunkSize=256] [-MaxRestarts=8] [-MinCount=Tag:N,...]"));
+		return 1;
+	}
+
+	UYukiWaveFunctionCollapseModel* Model = LoadObject<UYukiWaveFunctionCollapseModel>(nullptr, *ModelPath);
+	if (!Model)
+	{
+		UE_LOG(LogWFC, Error, TEXT("Could not load model %s."), *ModelPath);
+		return 1;
+	}
+	// The solvers below are initialized with this same published table.
+	const TSharedRef<const FYukiWaveFunctionCollapseCompiledModel> Rules = Model->GetSharedCompiledModel();
+
+	if (FPaths::IsRelative(Output))
+	{
+		Output = FPaths::Combine(FPaths::ProjectDir(), Output);
+	}
+	FYukiWaveFunctionCollapseBatchWriter Writer;
+	if (!Writer.Open(Output, Size, Rules->NumTiles(), Rules->ContentHash, ChunkSize))
+	{
+		return 1;
+	}
+
+	// Solvers are created and initialized here, the workers only Reset and solve them. That keeps
+	// UObject creation and the initial state cache on the game thread.
+	NumThreads = FMath::Min(NumThreads, SeedCount);
+	TArray<TStrongObjectPtr<UYukiWaveFunctionCollapseSolver>> Solvers;
+	for (int32 i = 0; i < NumThreads; i++)
+	{
+		Solvers.Emplace(NewObject<UYukiWaveFunctionCollapseSolver>());
+		Solvers.Last()->MaxRestarts = MaxRestarts;
+		Solvers.Last()->SetRequirements(MinCounts);
+		Solvers.Last()->Init(Model, Size, FRandomStream(SeedStart));
+	}
+
+	const uint32 RecordSize = Writer.GetRecordSize();
+	TArray<uint8> ChunkData;
+	int32 NumSolved = 0;
+	int32 NumRejected = 0;
+	TArray<int32> FailedSeeds;
+	int64 PeakWaveBytes = 0;
+	const double StartTime = FPlatformTime::Seconds();
+
+	for (int32 ChunkStart = 0; ChunkStart < SeedCount; ChunkStart += ChunkSize)
+	{
+		const int32 NumRecords = FMath::Min(ChunkSize, SeedCount - ChunkStart);
+		ChunkData.SetNumUninitialized(NumRecords * RecordSize);
+		std::atomic<int32> NextRecord = 0;
+
+		ParallelFor(NumThreads, [&](int32 ThreadIndex)
+		{
+			UYukiWaveFunctionCollapseSolver* Solver = Solvers[ThreadIndex].Get();
+			for (int32 Record = NextRecord++; Record < NumRecords; Record = NextRecord++)
+			{
+				const int32 Seed = SeedStart + ChunkStart + Record;
+				Solver->Reset(Seed);
+				Solver->SolveFully();
+				FYukiWaveFunctionCollapseBatchWriter::FillRecord(ChunkData.GetData() + Record * RecordSize, Seed, *Solver);
+			}
+		});
+
+		for (int32 Record = 0; Record < NumRecords; Record++)
+		{
+			const FYukiWaveFunctionCollapseBatchRecord* Written = reinterpret_cast<const FYukiWaveFunctionCollapseBatchRecord*>(ChunkData.GetData() + Record * RecordSize);
+			NumSolved += Written->IsSolved() ? 1 : 0;
+			NumRejected += Written->IsRejected() ? 1 : 0;
+			if (Written->HasGivenUp())
+			{
+				FailedSeeds.Add(Written->Seed);
+			}
+			PeakWaveBytes = FMath::Max(PeakWaveBytes, Written->BytesAllocated);
+		}
+		Writer.WriteChunk(NumRecords, ChunkData);
+		UE_LOG(LogWFC, Display, TEXT("Solved %d / %d seeds."), ChunkStart + NumRecords, SeedCount);
+	}
+
+	if (!Writer.Close())
+	{
+		UE_LOG(LogWFC, Error, TEXT("Failed to write %s."), *Output);
+		return 1;
+	}
+
+	if (FailedSeeds.Num() > 0)
+	{
+		// The records of these seeds carry the GaveUp flag, the list is only a summary.
+		const int32 NumListed = FMath::Min(FailedSeeds.Num(), 32);
+		FString SeedList = FString::JoinBy(MakeArrayView(FailedSeeds.GetData(), NumListed), TEXT(", "), [](int32 Seed) { return FString::FromInt(Seed); });
+		UE_LOG(LogWFC, Warning, TEXT("%d seeds gave up after %d restarts: %s%s"), FailedSeeds.Num(), MaxRestarts, *SeedList, FailedSeeds.Num() > NumListed ? TEXT(", ...") : TEXT(""));
+	}
+
+	const double Elapsed = FPlatformTime::Seconds() - StartTime;
+	UE_LOG(LogWFC, Display, TEXT("Wrote %d maps (%d solved, %d rejected) of %s to %s in %.2fs, %.1f maps/s on %d threads. Peak memory %.1f MB, peak solver state %.2f MB."),
+		SeedCount, NumSolved, NumRejected, *Size.ToString(), *Output, Elapsed, SeedCount / FMath::Max(Elapsed, UE_SMALL_NUMBER), NumThreads,
+		FPlatformMemory::GetStats().PeakUsedPhysical / (1024.0 * 1024.0), PeakWaveBytes / (1024.0 * 1024.0));
+	return 0;
+}
@@ -0,0 +1,306 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapsePreviewActor.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "UObject/ConstructorHelpers.h"
+
+AYukiWaveFunctionCollapsePreviewActor::AYukiWaveFunctionCollapsePreviewActor()
+{
+	SetRootComponent(CreateDefaultSubobject<USceneComponent>("SceneComponent"));
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.bStartWithTickEnabled = true;
+	bIsEditorOnlyActor = true;
+
+	static ConstructorHelpers::FObjectFinder<UStaticMesh> CubeMesh(TEXT("/Engine/BasicShapes/Cube.Cube"));
+	HeatmapMesh = CubeMesh.Object;
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+	// The solver is transient, start over after the level was loaded.
+	if (!Solver && Model)
+	{
+		Restart();
+	}
+	if (!Solver)
+	{
+		return;
+	}
+	if (bRunning)
+	{
+		RunIterations(IterationsPerTick, TimeBudgetMs / 1000.0);
+	}
+	UpdateInstances();
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+	const FName PropertyName = PropertyChangedEvent.GetMemberPropertyName();
+	if (PropertyName == GET_MEMBER_NAME_CHECKED(AYukiWaveFunctionCollapsePreviewActor, Model)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AYukiWaveFunctionCollapsePreviewActor, Size)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AYukiWaveFunctionCollapsePreviewActor, Seed)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AYukiWaveFunctionCollapsePreviewActor, HeatmapMesh)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AYukiWaveFunctionCollapsePreviewActor, HeatmapMaterial))
+	{
+		Restart();
+	}
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::Destroyed()
+{
+	UnbindModel();
+	Super::Destroyed();
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::Restart()
+{
+	ClearInstances();
+	Solver = nullptr;
+	Attempt = 0;
+	BindModel();
+	if (!Model || Size.X <= 0 || Size.Y <= 0 || Size.Z <= 0)
+	{
+		return;
+	}
+	Solver = NewObject<UYukiWaveFunctionCollapseSolver>(this, NAME_None, RF_Transient);
+	Solver->Init(Model, Size, FRandomStream(Seed));
+	TileSetHash = Solver->GetRules().TileSetHash;
+
+	const int NumCells = Solver->NumCells();
+	CellTiles.Init(INDEX_NONE, NumCells);
+	CellTileInstances.Init(INDEX_NONE, NumCells);
+	FreeTileInstances.SetNum(Solver->GetRules().NumTiles());
+	TileComponents.SetNum(Solver->GetRules().NumTiles());
+
+	if (HeatmapMesh)
+	{
+		HeatmapComponent = CreateInstancedComponent(HeatmapMesh, 1);
+		if (HeatmapMaterial)
+		{
+			HeatmapComponent->SetMaterial(0, HeatmapMaterial);
+		}
+		TArray<FTransform> Transforms;
+		Transforms.Init(FTransform::Identity, NumCells);
+		HeatmapComponent->AddInstances(Transforms, false);
+	}
+	UpdateInstances();
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::Step()
+{
+	if (!Solver)
+	{
+		Restart();
+	}
+	if (Solver)
+	{
+		RunIterations(1, MAX_dbl);
+		UpdateInstances();
+	}
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::BindModel()
+{
+	if (BoundModel.Get() == Model)
+	{
+		return;
+	}
+	UnbindModel();
+	if (Model)
+	{
+		RulesChangedHandle = Model->OnRulesChanged.AddUObject(this, &AYukiWaveFunctionCollapsePreviewActor::OnModelRulesChanged);
+		BoundModel = Model;
+	}
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::UnbindModel()
+{
+	if (UYukiWaveFunctionCollapseModel* Bound = BoundModel.Get())
+	{
+		Bound->OnRulesChanged.Remove(RulesChangedHandle);
+	}
+	BoundModel.Reset();
+	RulesChangedHandle.Reset();
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::OnModelRulesChanged(UYukiWaveFunctionCollapseModel* ChangedModel)
+{
+	if (!Solver || ChangedModel != Model)
+	{
+		return;
+	}
+	// Tile components are indexed by tile, they can only be kept while the tile set is. The solver keeps its
+	// old rules until RefreshRules, compare with the ones the model just published.
+	if (ChangedModel->GetCompiledModel().TileSetHash != TileSetHash)
+	{
+		Restart();
+		return;
+	}
+	Solver->RefreshRules();
+	UpdateInstances();
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::RunIterations(int32 MaxIterations, double BudgetSeconds)
+{
+	const double EndTime = FPlatformTime::Seconds() + BudgetSeconds;
+	for (int32 i = 0; i < MaxIterations && !Solver->IsSolved(); i++)
+	{
+		Solver->SingleIteration();
+		if (Solver->HasContradiction())
+		{
+			UE_LOG(LogWFC, Log, TEXT("Preview hit a contradiction, restarting with seed %d."), Seed + Attempt + 1);
+			Solver->Reset(Seed + ++Attempt);
+		}
+		if (FPlatformTime::Seconds() >= EndTime)
+		{
+			break;
+		}
+	}
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::UpdateInstances()
+{
+	bool bAllDirty;
+	Solver->ConsumeDirtyCells(DirtyCells, bAllDirty);
+	if (bAllDirty)
+	{
+		for (int Cell = 0; Cell < Solver->NumCells(); Cell++)
+		{
+			UpdateCell(Cell);
+		}
+	}
+	else
+	{
+		for (const int Cell : DirtyCells)
+		{
+			UpdateCell(Cell);
+		}
+	}
+	if (!bAllDirty && DirtyCells.Num() == 0)
+	{
+		return;
+	}
+
+	if (HeatmapComponent)
+	{
+		HeatmapComponent->MarkRenderStateDirty();
+	}
+	for (UInstancedStaticMeshComponent* Component : TileComponents)
+	{
+		if (Component)
+		{
+			Component->MarkRenderStateDirty();
+		}
+	}
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::UpdateCell(int Cell)
+{
+	const FYukiWaveFunctionCollapseCompiledModel& Rules = Solver->GetRules();
+	const int Tile = Solver->GetCollapsedTileIndex(Cell);
+
+	if (HeatmapComponent)
+	{
+		const float HiddenScale = Tile == INDEX_NONE ? 1.0f : 0.0f;
+		const float MeshSize = FMath::Max(HeatmapMesh->GetBounds().BoxExtent.GetMax() * 2.0f, 1.0f);
+		const FVector Scale(HiddenScale * HeatmapScale * Model->CellSize / MeshSize);
+		HeatmapComponent->UpdateInstanceTransform(Cell, GetCellTransform(Cell, FRotator::ZeroRotator, Scale), false, false, true);
+
+		// Normalized log entropy, -1 marks a contradiction.
+		const int Count = Solver->GetWave().GetCount(Cell);
+		const float Entropy = Count == 0 ? -1.0f : FMath::Loge((float) Count) / FMath::Max(FMath::Loge((float) Rules.NumTiles()), UE_SMALL_NUMBER);
+		HeatmapComponent->SetCustomDataValue(Cell, 0, Entropy, false);
+	}
+
+	const int PrevTile = CellTiles[Cell];
+	if (PrevTile == Tile)
+	{
+		return;
+	}
+	if (PrevTile != INDEX_NONE && CellTileInstances[Cell] != INDEX_NONE)
+	{
+		const FTransform Hidden = GetCellTransform(Cell, FRotator::ZeroRotator, FVector::ZeroVector);
+		TileComponents[PrevTile]->UpdateInstanceTransform(CellTileInstances[Cell], Hidden, false, false, true);
+		FreeTileInstances[PrevTile].Add(CellTileInstances[Cell]);
+	}
+	CellTiles[Cell] = Tile;
+	CellTileInstances[Cell] = INDEX_NONE;
+
+	if (Tile == INDEX_NONE)
+	{
+		return;
+	}
+	// The solver's rules may still name a tile removed from the model since, its cells stay hidden.
+	const FYukiWaveFunctionCollapseTileModel* TileModel = Model->Tiles.Find(Rules.TileTags[Tile]);
+	UInstancedStaticMeshComponent* Component = TileModel ? GetTileComponent(Tile) : nullptr;
+	if (!Component)
+	{
+		return;
+	}
+	const FTransform Transform = GetCellTransform(Cell, TileModel->Rotation, TileModel->Scale);
+	if (FreeTileInstances[Tile].Num() > 0)
+	{
+		CellTileInstances[Cell] = FreeTileInstances[Tile].Pop();
+		Component->UpdateInstanceTransform(CellTileInstances[Cell], Transform, false, false, true);
+	}
+	else
+	{
+		CellTileInstances[Cell] = Component->AddInstance(Transform, false);
+	}
+}
+
+void AYukiWaveFunctionCollapsePreviewActor::ClearInstances()
+{
+	if (HeatmapComponent)
+	{
+		HeatmapComponent->DestroyComponent();
+		HeatmapComponent = nullptr;
+	}
+	for (UInstancedStaticMeshComponent* Component : TileComponents)
+	{
+		if (Component)
+		{
+			Component->DestroyComponent();
+		}
+	}
+	TileComponents.Reset();
+	FreeTileInstances.Reset();
+	CellTiles.Reset();
+	CellTileInstances.Reset();
+}
+
+UInstancedStaticMeshComponent* AYukiWaveFunctionCollapsePreviewActor::GetTileComponent(int Tile)
+{
+	if (!TileComponents[Tile])
+	{
+		const FYukiWaveFunctionCollapseTileModel* TileModel = Model->Tiles.Find(Solver->GetRules().TileTags[Tile]);
+		if (UStaticMesh* Mesh = TileModel ? TileModel->StaticMesh.LoadSynchronous() : nullptr)
+		{
+			TileComponents[Tile] = CreateInstancedComponent(Mesh, 0);
+		}
+	}
+	return TileComponents[Tile];
+}
+
+UInstancedStaticMeshComponent* AYukiWaveFunctionCollapsePreviewActor::CreateInstancedComponent(UStaticMesh* Mesh, int NumCustomDataFloats)
+{
+	UInstancedStaticMeshComponent* Component = NewObject<UInstancedStaticMeshComponent>(this, NAME_None, RF_Transient);
+	Component->SetStaticMesh(Mesh);
+	Component->SetNumCustomDataFloats(NumCustomDataFloats);
+	Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	Component->SetupAttachment(GetRootComponent());
+	Component->RegisterComponent();
+	return Component;
+}
+
+FTransform AYukiWaveFunctionCollapsePreviewActor::GetCellTransform(int Cell, const FRotator& Rotation, const FVector& Scale) const
+{
+	return FTransform(Rotation, GetCellLocation(Model->Topology, Size, Cell) * Model->CellSize, Scale);
+}
@@ -12,4 +12,11 @@ public:
 	/** IModuleInterface implementation */
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;
+
+private:
+	// Compiles and validates model rule tables whenever a model is saved or cooked. A model with rule
+	// contradictions fails the cook, unless -YukiWFCAllowContradictions is on the command line.
+	static void OnObjectPreSave(UObject* Object, FObjectPreSaveContext SaveContext);
+
+	FDelegateHandle PreSaveHandle;
 };
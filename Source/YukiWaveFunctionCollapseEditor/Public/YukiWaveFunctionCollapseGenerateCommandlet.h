@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "YukiWaveFunctionCollapseGenerateCommandlet.generated.h"
+
+/**
+ * Solves a range of seeds of a model in parallel and streams the results into a batch file.
+ * Needs no world or actors, so it runs on headless build agents:
+ *
+ *   UnrealEditor-Cmd Project.uproject -run=YukiWaveFunctionCollapseGenerate -nullrhi
+ *       -Model=/Game/WFC/MyModel.MyModel -Size=32,32,4 -SeedStart=0 -SeedCount=10000
+ *       -Threads=16 -ChunkSize=256 -MaxRestarts=8 -MinCount=Tile.Door:2 -Output=Saved/WFC/MyModel.ywfc
+ *
+ * Seeds still contradicting after MaxRestarts restarts are written with the GaveUp flag and listed in the log.
+ * With -MinCount, seeds that can no longer place enough cells of a tag stop early and carry the Rejected flag.
+ */
+UCLASS()
+class UYukiWaveFunctionCollapseGenerateCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UYukiWaveFunctionCollapseGenerateCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,125 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "YukiWaveFunctionCollapsePreviewActor.generated.h"
+
+class UInstancedStaticMeshComponent;
+class UMaterialInterface;
+class UStaticMesh;
+class UYukiWaveFunctionCollapseModel;
+class UYukiWaveFunctionCollapseSolver;
+
+/**
+ * AYukiWaveFunctionCollapsePreviewActor
+ *
+ * Steps a solver inside the editor viewport. Every tick runs up to IterationsPerTick iterations within
+ * TimeBudgetMs and only updates the instances of cells the solver reports as dirty. Collapsed cells
+ * are drawn with their tile StaticMesh, uncollapsed cells as an entropy heatmap.
+ */
+UCLASS(NotBlueprintable)
+class YUKIWAVEFUNCTIONCOLLAPSEEDITOR_API AYukiWaveFunctionCollapsePreviewActor : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AYukiWaveFunctionCollapsePreviewActor();
+
+	virtual void Tick(float DeltaSeconds) override;
+	virtual bool ShouldTickIfViewportsOnly() const override { return true; }
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+	virtual void Destroyed() override;
+
+	// Restarts the preview from the current Seed.
+	UFUNCTION(CallInEditor, Category = "Preview")
+	void Restart();
+
+	// Runs a single iteration while paused.
+	UFUNCTION(CallInEditor, Category = "Preview")
+	void Step();
+
+	UPROPERTY(EditAnywhere, Category = "Preview")
+	TObjectPtr<UYukiWaveFunctionCollapseModel> Model;
+
+	UPROPERTY(EditAnywhere, Category = "Preview")
+	FIntVector Size = FIntVector(10, 10, 1);
+
+	UPROPERTY(EditAnywhere, Category = "Preview")
+	int32 Seed = 0;
+
+	UPROPERTY(EditAnywhere, Category = "Preview")
+	bool bRunning = true;
+
+	/**
+	 * Upper bound of iterations run per tick.
+	 */
+	UPROPERTY(EditAnywhere, Category = "Preview", meta = (ClampMin = 1))
+	int32 IterationsPerTick = 16;
+
+	/**
+	 * Time budget per tick for iterations, in milliseconds.
+	 */
+	UPROPERTY(EditAnywhere, Category = "Preview", meta = (ClampMin = 0.1))
+	float TimeBudgetMs = 4.0f;
+
+	/**
+	 * Mesh drawn for uncollapsed cells. PerInstanceCustomData 0 holds the normalized entropy.
+	 */
+	UPROPERTY(EditAnywhere, Category = "Preview|Heatmap")
+	TObjectPtr<UStaticMesh> HeatmapMesh;
+
+	UPROPERTY(EditAnywhere, Category = "Preview|Heatmap")
+	TObjectPtr<UMaterialInterface> HeatmapMaterial;
+
+	/**
+	 * Size of the heatmap mesh relative to the cell.
+	 */
+	UPROPERTY(EditAnywhere, Category = "Preview|Heatmap", meta = (ClampMin = 0.0, ClampMax = 1.0))
+	float HeatmapScale = 0.25f;
+
+protected:
+	void RunIterations(int32 MaxIterations, double BudgetSeconds);
+	void UpdateInstances();
+	void UpdateCell(int Cell);
+	void ClearInstances();
+
+	// Returns the instanced component drawing a tile, creating it on first use. Null if the tile has no StaticMesh.
+	UInstancedStaticMeshComponent* GetTileComponent(int Tile);
+	UInstancedStaticMeshComponent* CreateInstancedComponent(UStaticMesh* Mesh, int NumCustomDataFloats);
+
+	FTransform GetCellTransform(int Cell, const FRotator& Rotation, const FVector& Scale) const;
+
+	void BindModel();
+	void UnbindModel();
+	// Keeps the solve when only the rules of existing tiles changed, restarts if tiles were added or removed.
+	void OnModelRulesChanged(UYukiWaveFunctionCollapseModel* ChangedModel);
+
+	UPROPERTY(Transient)
+	TObjectPtr<UYukiWaveFunctionCollapseSolver> Solver;
+
+	UPROPERTY(Transient)
+	TObjectPtr<UInstancedStaticMeshComponent> HeatmapComponent;
+
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UInstancedStaticMeshComponent>> TileComponents;
+
+	// Instances of a tile component that are hidden and can be reused.
+	TArray<TArray<int32>> FreeTileInstances;
+
+	// Tile and instance currently drawn for every cell, INDEX_NONE when drawn as heatmap.
+	TArray<int> CellTiles;
+	TArray<int32> CellTileInstances;
+
+	TArray<int> DirtyCells;
+
+	// Number of restarts after contradictions, offsets the seed of the next attempt.
+	int32 Attempt = 0;
+
+	// Model whose OnRulesChanged is bound, Model may have been changed since.
+	TWeakObjectPtr<UYukiWaveFunctionCollapseModel> BoundModel;
+	FDelegateHandle RulesChangedHandle;
+	// TileSetHash of the rules the tile components were created for.
+	uint64 TileSetHash = 0;
+};
@@ -37,6 +37,7 @@ public class YukiWaveFunctionCollapseEditor : ModuleRules
 				"SlateCore",
 				"UnrealEd",
 				"AssetTools",
+				"GameplayTags",
 				"YukiWaveFunctionCollapseRuntime",
 				// ... add private dependencies that you statically link with here ...	
 			}
@@ -0,0 +1,216 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseBatchFile.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+
+FYukiWaveFunctionCollapseBatchWriter::~FYukiWaveFunctionCollapseBatchWriter()
+{
+	Close();
+}
+
+bool FYukiWaveFunctionCollapseBatchWriter::Open(const FString& Filename, const FIntVector& Size, int NumTiles, uint64 ContentHash, int RecordsPerChunk)
+{
+	if (NumTiles >= FYukiWaveFunctionCollapseBatchRecord::UncollapsedTile)
+	{
+		UE_LOG(LogWFC, Error, TEXT("Batch files store tile indices as uint16, %d tiles is too many."), NumTiles);
+		return false;
+	}
+	Writer.Reset(IFileManager::Get().CreateFileWriter(*Filename));
+	if (!Writer)
+	{
+		UE_LOG(LogWFC, Error, TEXT("Could not open %s for writing."), *Filename);
+		return false;
+	}
+	Header = FYukiWaveFunctionCollapseBatchFileHeader();
+	Header.SizeX = Size.X;
+	Header.SizeY = Size.Y;
+	Header.SizeZ = Size.Z;
+	Header.NumTiles = NumTiles;
+	Header.ContentHash = ContentHash;
+	Header.RecordsPerChunk = RecordsPerChunk;
+	Header.RecordSize = ComputeRecordSize(Size.X * Size.Y * Size.Z);
+	Chunks.Reset();
+
+	// Reserve the header, it is rewritten with the final counts on Close.
+	Writer->Serialize(&Header, sizeof(Header));
+	return true;
+}
+
+void FYukiWaveFunctionCollapseBatchWriter::WriteChunk(int NumRecords, TConstArrayView<uint8> RecordData)
+{
+	check(Writer);
+	check(RecordData.Num() == NumRecords * (int) Header.RecordSize);
+
+	FYukiWaveFunctionCollapseBatchChunk& Chunk = Chunks.AddDefaulted_GetRef();
+	Chunk.Offset = Writer->Tell();
+	Chunk.FirstRecord = Header.NumRecords;
+	Chunk.NumRecords = NumRecords;
+	Writer->Serialize(const_cast<uint8*>(RecordData.GetData()), RecordData.Num());
+	Header.NumRecords += NumRecords;
+}
+
+bool FYukiWaveFunctionCollapseBatchWriter::Close()
+{
+	if (!Writer)
+	{
+		return false;
+	}
+	Header.NumChunks = Chunks.Num();
+	Header.IndexOffset = Writer->Tell();
+	Writer->Serialize(Chunks.GetData(), Chunks.Num() * sizeof(FYukiWaveFunctionCollapseBatchChunk));
+	Writer->Seek(0);
+	Writer->Serialize(&Header, sizeof(Header));
+	const bool bSuccess = Writer->Close() && !Writer->IsError();
+	Writer.Reset();
+	return bSuccess;
+}
+
+void FYukiWaveFunctionCollapseBatchWriter::FillRecord(uint8* Dest, int32 Seed, const UYukiWaveFunctionCollapseSolver& Solver)
+{
+	const FYukiWaveFunctionCollapseSolveStats Stats = Solver.GetSolveStats();
+	FYukiWaveFunctionCollapseBatchRecord Record;
+	Record.Seed = Seed;
+	Record.Flags = Solver.NumCells() > 0 && !Solver.HasContradiction() ? FYukiWaveFunctionCollapseBatchRecord::Solved : 0;
+	Record.Flags |= Solver.IsRejected() ? FYukiWaveFunctionCollapseBatchRecord::Rejected : 0;
+	Record.Iterations = Stats.Iterations;
+	Record.Collapses = Stats.Collapses;
+	Record.PropagationPops = Stats.PropagationPops;
+	Record.Eliminations = Stats.Eliminations;
+	Record.Contradictions = Stats.Contradictions;
+	Record.Restarts = Stats.Restarts;
+	Record.Backtracks = Stats.Backtracks;
+	Record.PeakWorklistSize = Stats.PeakWorklistSize;
+	Record.BytesAllocated = Stats.PeakBytesAllocated;
+	Record.InitMs = (float) (Stats.InitSeconds * 1000.0);
+	Record.SelectMs = (float) (Stats.SelectSeconds * 1000.0);
+	Record.CollapseMs = (float) (Stats.CollapseSeconds * 1000.0);
+	Record.PropagateMs = (float) (Stats.PropagateSeconds * 1000.0);
+
+	uint16* Tiles = reinterpret_cast<uint16*>(Dest + sizeof(FYukiWaveFunctionCollapseBatchRecord));
+	for (int i = 0; i < Solver.NumCells(); i++)
+	{
+		const int Tile = Solver.GetCollapsedTileIndex(i);
+		if (Tile == INDEX_NONE)
+		{
+			Record.Flags &= ~FYukiWaveFunctionCollapseBatchRecord::Solved;
+		}
+		Tiles[i] = Tile != INDEX_NONE ? (uint16) Tile : FYukiWaveFunctionCollapseBatchRecord::UncollapsedTile;
+	}
+	if (!Record.IsSolved() && !Record.IsRejected())
+	{
+		Record.Flags |= FYukiWaveFunctionCollapseBatchRecord::GaveUp;
+	}
+	FMemory::Memcpy(Dest, &Record, sizeof(Record));
+
+	const uint32 Used = sizeof(FYukiWaveFunctionCollapseBatchRecord) + Solver.NumCells() * sizeof(uint16);
+	FMemory::Memzero(Dest + Used, ComputeRecordSize(Solver.NumCells()) - Used);
+}
+
+uint32 FYukiWaveFunctionCollapseBatchWriter::ComputeRecordSize(int NumCells)
+{
+	return Align(sizeof(FYukiWaveFunctionCollapseBatchRecord) + NumCells * sizeof(uint16), 8);
+}
+
+FYukiWaveFunctionCollapseBatchReader::FYukiWaveFunctionCollapseBatchReader() = default;
+FYukiWaveFunctionCollapseBatchReader::~FYukiWaveFunctionCollapseBatchReader() = default;
+
+bool FYukiWaveFunctionCollapseBatchReader::Open(const FString& Filename)
+{
+	MappedRegion.Reset();
+	MappedHandle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (!MappedHandle || MappedHandle->GetFileSize() < (int64) sizeof(FYukiWaveFunctionCollapseBatchFileHeader))
+	{
+		UE_LOG(LogWFC, Error, TEXT("Could not map batch file %s."), *Filename);
+		return false;
+	}
+	MappedRegion.Reset(MappedHandle->MapRegion());
+	if (!MappedRegion)
+	{
+		UE_LOG(LogWFC, Error, TEXT("Could not map batch file %s."), *Filename);
+		return false;
+	}
+	Data = MappedRegion->GetMappedPtr();
+	FMemory::Memcpy(&Header, Data, sizeof(Header));
+	if (Header.Magic != FYukiWaveFunctionCollapseBatchFileHeader::MagicValue || Header.Version != FYukiWaveFunctionCollapseBatchFileHeader::CurrentVersion)
+	{
+		UE_LOG(LogWFC, Error, TEXT("%s is not a batch file of version %u."), *Filename, FYukiWaveFunctionCollapseBatchFileHeader::CurrentVersion);
+		return false;
+	}
+	if (!ValidateLayout((uint64) MappedRegion->GetMappedSize()))
+	{
+		UE_LOG(LogWFC, Error, TEXT("Batch file %s is truncated or corrupt."), *Filename);
+		Chunks = TConstArrayView<FYukiWaveFunctionCollapseBatchChunk>();
+		Header = FYukiWaveFunctionCollapseBatchFileHeader();
+		MappedRegion.Reset();
+		MappedHandle.Reset();
+		Data = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool FYukiWaveFunctionCollapseBatchReader::ValidateLayout(uint64 FileSize)
+{
+	if (Header.SizeX <= 0 || Header.SizeY <= 0 || Header.SizeZ <= 0 || Header.NumRecords < 0 || Header.NumChunks < 0 || Header.RecordsPerChunk <= 0)
+	{
+		return false;
+	}
+	const uint64 NumCells = (uint64) Header.SizeX * Header.SizeY * Header.SizeZ;
+	if (NumCells > MAX_int32 || Header.RecordSize != FYukiWaveFunctionCollapseBatchWriter::ComputeRecordSize((int) NumCells))
+	{
+		return false;
+	}
+	// Every comparison is done on sizes already known to fit in the file, so none of the sums can wrap.
+	if (Header.IndexOffset < sizeof(FYukiWaveFunctionCollapseBatchFileHeader) || Header.IndexOffset > FileSize
+		|| (uint64) Header.NumChunks > (FileSize - Header.IndexOffset) / sizeof(FYukiWaveFunctionCollapseBatchChunk))
+	{
+		return false;
+	}
+	Chunks = MakeArrayView(reinterpret_cast<const FYukiWaveFunctionCollapseBatchChunk*>(Data + Header.IndexOffset), Header.NumChunks);
+
+	// GetRecordData finds the chunk of a record by dividing with RecordsPerChunk, so the chunks have to be
+	// laid out exactly like the writer does it, and each one has to end before the index.
+	int64 NumRecords = 0;
+	for (int ChunkIndex = 0; ChunkIndex < Chunks.Num(); ChunkIndex++)
+	{
+		const FYukiWaveFunctionCollapseBatchChunk& Chunk = Chunks[ChunkIndex];
+		const bool bLast = ChunkIndex == Chunks.Num() - 1;
+		if (Chunk.FirstRecord != NumRecords || Chunk.NumRecords <= 0 || Chunk.NumRecords > Header.RecordsPerChunk
+			|| (!bLast && Chunk.NumRecords != Header.RecordsPerChunk))
+		{
+			return false;
+		}
+		if (Chunk.Offset < sizeof(FYukiWaveFunctionCollapseBatchFileHeader) || Chunk.Offset > Header.IndexOffset
+			|| (uint64) Chunk.NumRecords > (Header.IndexOffset - Chunk.Offset) / Header.RecordSize)
+		{
+			return false;
+		}
+		NumRecords += Chunk.NumRecords;
+	}
+	return NumRecords == Header.NumRecords;
+}
+
+const uint8* FYukiWaveFunctionCollapseBatchReader::GetRecordData(int Index) const
+{
+	check(Index >= 0 && Index < Header.NumRecords);
+	// Chunks hold RecordsPerChunk records each, except the last one.
+	const FYukiWaveFunctionCollapseBatchChunk& Chunk = Chunks[Index / Header.RecordsPerChunk];
+	return Data + Chunk.Offset + (uint64) (Index - Chunk.FirstRecord) * Header.RecordSize;
+}
+
+const FYukiWaveFunctionCollapseBatchRecord& FYukiWaveFunctionCollapseBatchReader::GetRecord(int Index) const
+{
+	return *reinterpret_cast<const FYukiWaveFunctionCollapseBatchRecord*>(GetRecordData(Index));
+}
+
+TConstArrayView<uint16> FYukiWaveFunctionCollapseBatchReader::GetTiles(int Index) const
+{
+	const uint16* Tiles = reinterpret_cast<const uint16*>(GetRecordData(Index) + sizeof(FYukiWaveFunctionCollapseBatchRecord));
+	return MakeArrayView(Tiles, Header.SizeX * Header.SizeY * Header.SizeZ);
+}
@@ -0,0 +1,399 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseCompiledModel.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Hash/CityHash.h"
+
+namespace YukiWaveFunctionCollapseCompiledModel
+{
+	// Tiles sorted by tag name, so indices and hashes do not depend on TMap ordering.
+	TArray<FGameplayTag> GetSortedTileTags(const UYukiWaveFunctionCollapseModel& Model)
+	{
+		TArray<FGameplayTag> Tags;
+		Model.Tiles.GetKeys(Tags);
+		Tags.Sort([](const FGameplayTag& A, const FGameplayTag& B) { return A.GetTagName().LexicalLess(B.GetTagName()); });
+		return Tags;
+	}
+
+	TArray<FGameplayTag> GetSortedTags(const FGameplayTagContainer& Container)
+	{
+		TArray<FGameplayTag> Tags = Container.GetGameplayTagArray();
+		Tags.Sort([](const FGameplayTag& A, const FGameplayTag& B) { return A.GetTagName().LexicalLess(B.GetTagName()); });
+		return Tags;
+	}
+
+	template <typename T>
+	uint64 HashValue(uint64 Hash, const T& Value)
+	{
+		return CityHash64WithSeed(reinterpret_cast<const char*>(&Value), sizeof(T), Hash);
+	}
+
+	uint64 HashString(uint64 Hash, const FString& String)
+	{
+		return CityHash64WithSeed(reinterpret_cast<const char*>(*String), String.Len() * sizeof(TCHAR), Hash);
+	}
+
+	uint64 HashTag(uint64 Hash, const FGameplayTag& Tag)
+	{
+		return HashString(Hash, Tag.ToString());
+	}
+}
+
+void FYukiWaveFunctionCollapseCompiledModel::Compile(const UYukiWaveFunctionCollapseModel& Model)
+{
+	using namespace YukiWaveFunctionCollapseCompiledModel;
+
+	constexpr int NumDirections = (int) EYDWaveFunctionDirection::MAX;
+
+	const TArray<FGameplayTag> SortedTags = GetSortedTileTags(Model);
+	const uint64 NewTileSetHash = ComputeTileSetHash(Model, SortedTags);
+	TArray<uint64> NewTileHashes;
+	NewTileHashes.Reserve(SortedTags.Num());
+	for (const FGameplayTag& Tag : SortedTags)
+	{
+		NewTileHashes.Add(ComputeTileHash(Model, Tag));
+	}
+
+	// Same tiles in the same order, only the rows of tiles whose rules changed are rebuilt.
+	if (IsCompiled() && TileSetHash == NewTileSetHash && TileHashes.Num() == NewTileHashes.Num() && TileContradictions.Num() == NewTileHashes.Num())
+	{
+		TArray<int> ChangedTiles;
+		for (int Tile = 0; Tile < NumTiles(); Tile++)
+		{
+			if (TileHashes[Tile] != NewTileHashes[Tile])
+			{
+				ChangedTiles.Add(Tile);
+			}
+		}
+		RecompileTiles(Model, ChangedTiles);
+		TileHashes = MoveTemp(NewTileHashes);
+		VisualHash = ComputeVisualHash(Model, SortedTags);
+		CompileBorders(Model);
+		ContentHash = CombineContentHash(Model, TileSetHash, TileHashes);
+		UE_LOG(LogWFC, Verbose, TEXT("Recompiled %d of %d tiles of %s."), ChangedTiles.Num(), NumTiles(), *Model.GetName());
+		return;
+	}
+
+	Topology = Model.Topology;
+	TileTags = SortedTags;
+	TileIndices.Reset();
+	AllTags.Reset();
+	for (int i = 0; i < TileTags.Num(); i++)
+	{
+		TileIndices.Add(TileTags[i], i);
+		AllTags.AddTag(TileTags[i]);
+	}
+	NumWords = FMath::DivideAndRoundUp(TileTags.Num(), 64);
+
+	AllMask.Init(0, NumWords);
+	for (int i = 0; i < TileTags.Num(); i++)
+	{
+		AllMask[i / 64] |= 1ull << (i % 64);
+	}
+
+	Weights.SetNum(TileTags.Num());
+	MaxCounts.SetNum(TileTags.Num());
+	WalkDirections.SetNum(TileTags.Num());
+	Propagator.Init(0, NumDirections * TileTags.Num() * NumWords);
+	TileContradictions.Init(0, TileTags.Num());
+
+	for (int Tile = 0; Tile < TileTags.Num(); Tile++)
+	{
+		TileContradictions[Tile] = CompileTile(Model, Tile) ? 0 : MissingNeighbor;
+	}
+	bHasContradictions = false;
+	for (int Tile = 0; Tile < TileTags.Num(); Tile++)
+	{
+		TileContradictions[Tile] |= ValidateTile(Tile) ? 0 : UnmirroredRule;
+		bHasContradictions |= TileContradictions[Tile] != 0;
+	}
+
+	CompileBorders(Model);
+	TileSetHash = NewTileSetHash;
+	TileHashes = MoveTemp(NewTileHashes);
+	VisualHash = ComputeVisualHash(Model, SortedTags);
+	ContentHash = CombineContentHash(Model, TileSetHash, TileHashes);
+}
+
+void FYukiWaveFunctionCollapseCompiledModel::RecompileTiles(const UYukiWaveFunctionCollapseModel& Model, TConstArrayView<int> ChangedTiles)
+{
+	if (ChangedTiles.Num() == 0)
+	{
+		return;
+	}
+	TArray<uint64> ChangedMask;
+	ChangedMask.Init(0, NumWords);
+	for (const int Tile : ChangedTiles)
+	{
+		ChangedMask[Tile / 64] |= 1ull << (Tile % 64);
+		TileContradictions[Tile] = CompileTile(Model, Tile) ? 0 : MissingNeighbor;
+	}
+
+	// Rows of the changed tiles are new, their columns are where other tiles point at them. Only tiles on
+	// either side of those rules can have gained or lost a contradiction.
+	const TConstArrayView<EYDWaveFunctionDirection> Directions = GetTopologyDirections(Topology);
+	bHasContradictions = false;
+	for (int Tile = 0; Tile < NumTiles(); Tile++)
+	{
+		bool bAffected = (ChangedMask[Tile / 64] & (1ull << (Tile % 64))) != 0;
+		for (int i = 0; i < Directions.Num() && !bAffected; i++)
+		{
+			const uint64* Row = GetPropagatorRow(Directions[i], Tile);
+			for (int Word = 0; Word < NumWords && !bAffected; Word++)
+			{
+				bAffected = (Row[Word] & ChangedMask[Word]) != 0;
+			}
+		}
+		if (bAffected)
+		{
+			TileContradictions[Tile] = (TileContradictions[Tile] & MissingNeighbor) | (ValidateTile(Tile) ? 0 : UnmirroredRule);
+		}
+		bHasContradictions |= TileContradictions[Tile] != 0;
+	}
+}
+
+bool FYukiWaveFunctionCollapseCompiledModel::CompileTile(const UYukiWaveFunctionCollapseModel& Model, int Tile)
+{
+	const FGameplayTag& Tag = TileTags[Tile];
+	const FYukiWaveFunctionCollapseTileModel& TileData = Model.Tiles[Tag];
+	Weights[Tile] = TileData.Weight;
+	MaxCounts[Tile] = TileData.MaxCount;
+	WalkDirections[Tile] = 0;
+	for (const EYDWaveFunctionDirection WalkDirection : TileData.WalkDirections)
+	{
+		WalkDirections[Tile] |= 1u << (uint32) WalkDirection;
+	}
+
+	uint32 TopologyDirections = 0;
+	for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Topology))
+	{
+		TopologyDirections |= 1u << (uint32) Direction;
+	}
+
+	bool bValid = true;
+	for (int Direction = 0; Direction < (int) EYDWaveFunctionDirection::MAX; Direction++)
+	{
+		uint64* Row = Propagator.GetData() + (Direction * NumTiles() + Tile) * NumWords;
+		FMemory::Memzero(Row, NumWords * sizeof(uint64));
+		const FGameplayTagContainer* Options = TileData.Options.Find((EYDWaveFunctionDirection) Direction);
+		// Hex directions on a cube grid are never read by the solver.
+		if (!Options || !(TopologyDirections & (1u << Direction)))
+		{
+			continue;
+		}
+		for (const FGameplayTag& Neighbor : *Options)
+		{
+			const int NeighborIndex = GetTileIndex(Neighbor);
+			if (NeighborIndex == INDEX_NONE)
+			{
+				UE_LOG(LogWFC, Warning, TEXT("Tile %s has a neighbor %s that does not exist."), *Tag.ToString(), *Neighbor.ToString());
+				bValid = false;
+				continue;
+			}
+			Row[NeighborIndex / 64] |= 1ull << (NeighborIndex % 64);
+		}
+	}
+	return bValid;
+}
+
+bool FYukiWaveFunctionCollapseCompiledModel::ValidateTile(int Tile) const
+{
+	// A contradiction occurs if we claim to have a neighbor but they claim to not have
+	// us in the opposite direction.
+	bool bValid = true;
+	for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Topology))
+	{
+		const EYDWaveFunctionDirection OppositeDirection = GetOppositeDirection(Direction);
+		const uint64* Row = GetPropagatorRow(Direction, Tile);
+		for (int Word = 0; Word < NumWords; Word++)
+		{
+			uint64 Bits = Row[Word];
+			while (Bits)
+			{
+				const int Neighbor = Word * 64 + (int) FMath::CountTrailingZeros64(Bits);
+				Bits &= Bits - 1;
+				if (GetPropagatorRow(OppositeDirection, Neighbor)[Tile / 64] & (1ull << (Tile % 64)))
+				{
+					continue;
+				}
+				UE_LOG(LogWFC, Warning, TEXT("Tile %s has a connection from %s to %s but neighbor does not have it from %s"), *TileTags[Tile].ToString(), *UEnum::GetValueAsString(Direction), *TileTags[Neighbor].ToString(), *UEnum::GetValueAsString(OppositeDirection));
+				bValid = false;
+			}
+		}
+	}
+	return bValid;
+}
+
+void FYukiWaveFunctionCollapseCompiledModel::CompileBorders(const UYukiWaveFunctionCollapseModel& Model)
+{
+	constexpr int NumDirections = (int) EYDWaveFunctionDirection::MAX;
+	BorderDirections = 0;
+	BorderMasks.Init(0, NumDirections * NumWords);
+	TArray<uint64> Matching;
+	Matching.SetNumUninitialized(NumWords);
+	for (int Direction = 0; Direction < NumDirections; Direction++)
+	{
+		uint64* Mask = BorderMasks.GetData() + Direction * NumWords;
+		const FGameplayTagContainer* Border = Model.Borders.Find((EYDWaveFunctionDirection) Direction);
+		if (Border && Border->Num() > 0)
+		{
+			// Borders match hierarchically like FGameplayTagContainer::Filter, a parent tag allows all of its child tiles.
+			for (const FGameplayTag& Tag : *Border)
+			{
+				GetMatchingMask(Tag, Matching.GetData());
+				for (int Word = 0; Word < NumWords; Word++)
+				{
+					Mask[Word] |= Matching[Word];
+				}
+			}
+			BorderDirections |= 1u << Direction;
+		}
+		else
+		{
+			FMemory::Memcpy(Mask, AllMask.GetData(), NumWords * sizeof(uint64));
+		}
+	}
+}
+
+uint64 FYukiWaveFunctionCollapseCompiledModel::ComputeContentHash(const UYukiWaveFunctionCollapseModel& Model)
+{
+	using namespace YukiWaveFunctionCollapseCompiledModel;
+
+	const TArray<FGameplayTag> SortedTags = GetSortedTileTags(Model);
+	TArray<uint64> Hashes;
+	Hashes.Reserve(SortedTags.Num());
+	for (const FGameplayTag& Tag : SortedTags)
+	{
+		Hashes.Add(ComputeTileHash(Model, Tag));
+	}
+	return CombineContentHash(Model, ComputeTileSetHash(Model, SortedTags), Hashes);
+}
+
+uint64 FYukiWaveFunctionCollapseCompiledModel::ComputeTileSetHash(const UYukiWaveFunctionCollapseModel& Model, TConstArrayView<FGameplayTag> SortedTags)
+{
+	using namespace YukiWaveFunctionCollapseCompiledModel;
+
+	uint64 Hash = CompiledVersion;
+	Hash = HashValue(Hash, Model.Topology);
+	for (const FGameplayTag& Tag : SortedTags)
+	{
+		Hash = HashTag(Hash, Tag);
+	}
+	return Hash;
+}
+
+uint64 FYukiWaveFunctionCollapseCompiledModel::ComputeTileHash(const UYukiWaveFunctionCollapseModel& Model, const FGameplayTag& Tag)
+{
+	using namespace YukiWaveFunctionCollapseCompiledModel;
+
+	constexpr int NumDirections = (int) EYDWaveFunctionDirection::MAX;
+
+	const FYukiWaveFunctionCollapseTileModel& TileData = Model.Tiles[Tag];
+	uint64 Hash = HashTag(0, Tag);
+	Hash = HashValue(Hash, TileData.Weight);
+	Hash = HashValue(Hash, TileData.MaxCount);
+	for (int Direction = 0; Direction < NumDirections; Direction++)
+	{
+		Hash = HashValue(Hash, TileData.WalkDirections.Contains((EYDWaveFunctionDirection) Direction));
+	}
+	for (int Direction = 0; Direction < NumDirections; Direction++)
+	{
+		Hash = HashValue(Hash, Direction);
+		if (const FGameplayTagContainer* Options = TileData.Options.Find((EYDWaveFunctionDirection) Direction))
+		{
+			for (const FGameplayTag& Neighbor : GetSortedTags(*Options))
+			{
+				Hash = HashTag(Hash, Neighbor);
+			}
+		}
+	}
+	return Hash;
+}
+
+uint64 FYukiWaveFunctionCollapseCompiledModel::ComputeVisualHash(const UYukiWaveFunctionCollapseModel& Model, TConstArrayView<FGameplayTag> SortedTags)
+{
+	using namespace YukiWaveFunctionCollapseCompiledModel;
+
+	uint64 Hash = CompiledVersion;
+	for (const FGameplayTag& Tag : SortedTags)
+	{
+		const FYukiWaveFunctionCollapseTileModel& TileData = Model.Tiles[Tag];
+		Hash = HashTag(Hash, Tag);
+		Hash = HashString(Hash, TileData.TileActor.ToString());
+		Hash = HashValue(Hash, TileData.Rotation);
+		Hash = HashValue(Hash, TileData.Scale);
+		Hash = HashString(Hash, TileData.StaticMesh.ToString());
+		Hash = HashString(Hash, TileData.BrushTexture.ToString());
+	}
+	return Hash != 0 ? Hash : 1;
+}
+
+uint64 FYukiWaveFunctionCollapseCompiledModel::CombineContentHash(const UYukiWaveFunctionCollapseModel& Model, uint64 InTileSetHash, TConstArrayView<uint64> InTileHashes)
+{
+	using namespace YukiWaveFunctionCollapseCompiledModel;
+
+	constexpr int NumDirections = (int) EYDWaveFunctionDirection::MAX;
+
+	uint64 Hash = InTileSetHash;
+	for (const uint64 TileHash : InTileHashes)
+	{
+		Hash = HashValue(Hash, TileHash);
+	}
+	for (int Direction = 0; Direction < NumDirections; Direction++)
+	{
+		Hash = HashValue(Hash, Direction);
+		if (const FGameplayTagContainer* Border = Model.Borders.Find((EYDWaveFunctionDirection) Direction))
+		{
+			for (const FGameplayTag& Tag : GetSortedTags(*Border))
+			{
+				Hash = HashTag(Hash, Tag);
+			}
+		}
+	}
+	// 0 is reserved for "not compiled".
+	return Hash != 0 ? Hash : 1;
+}
+
+FGameplayTagContainer FYukiWaveFunctionCollapseCompiledModel::MaskToTags(const uint64* Mask) const
+{
+	FGameplayTagContainer Tags;
+	for (int Word = 0; Word < NumWords; Word++)
+	{
+		uint64 Bits = Mask[Word];
+		while (Bits)
+		{
+			const int Tile = Word * 64 + (int) FMath::CountTrailingZeros64(Bits);
+			Tags.AddTagFast(TileTags[Tile]);
+			Bits &= Bits - 1;
+		}
+	}
+	return Tags;
+}
+
+void FYukiWaveFunctionCollapseCompiledModel::TagsToMask(const FGameplayTagContainer& Tags, uint64* OutMask) const
+{
+	FMemory::Memzero(OutMask, NumWords * sizeof(uint64));
+	for (const FGameplayTag& Tag : Tags)
+	{
+		const int Tile = GetTileIndex(Tag);
+		if (Tile != INDEX_NONE)
+		{
+			OutMask[Tile / 64] |= 1ull << (Tile % 64);
+		}
+	}
+}
+
+void FYukiWaveFunctionCollapseCompiledModel::GetMatchingMask(const FGameplayTag& Tag, uint64* OutMask) const
+{
+	FMemory::Memzero(OutMask, NumWords * sizeof(uint64));
+	for (int Tile = 0; Tile < TileTags.Num(); Tile++)
+	{
+		if (TileTags[Tile].MatchesTag(Tag))
+		{
+			OutMask[Tile / 64] |= 1ull << (Tile % 64);
+		}
+	}
+}
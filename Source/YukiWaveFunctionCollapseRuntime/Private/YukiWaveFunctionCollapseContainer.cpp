@@ -4,6 +4,45 @@
 #include "YukiWaveFunctionCollapseContainer.h"
 
 #include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseMeshMerge.h"
+#include "YukiWaveFunctionCollapseStreamingSolver.h"
+#include "Async/Async.h"
+#include "Components/ChildActorComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Hash/CityHash.h"
+#include "MeshDescription.h"
+#include "NavigationSystem.h"
+#include "UObject/Package.h"
+
+namespace YukiWaveFunctionCollapseContainer
+{
+	// Merged meshes by the content of their chunk. Game thread only.
+	TMap<uint64, TWeakObjectPtr<UStaticMesh>> MergedMeshCache;
+	// Entries after the last sweep of garbage collected meshes, the next sweep runs once this doubled.
+	int NumMergedMeshesAfterSweep = 0;
+
+	void AddMergedMesh(uint64 Key, UStaticMesh* Mesh)
+	{
+		MergedMeshCache.Add(Key, Mesh);
+		if (MergedMeshCache.Num() >= FMath::Max(2 * NumMergedMeshesAfterSweep, 64))
+		{
+			for (auto It = MergedMeshCache.CreateIterator(); It; ++It)
+			{
+				if (!It->Value.IsValid())
+				{
+					It.RemoveCurrent();
+				}
+			}
+			NumMergedMeshesAfterSweep = MergedMeshCache.Num();
+		}
+	}
+
+	uint64 HashString(uint64 Hash, const FString& String)
+	{
+		return CityHash64WithSeed(reinterpret_cast<const char*>(*String), String.Len() * sizeof(TCHAR), Hash);
+	}
+}
 
 // Sets default values
 AYukiWaveFunctionCollapseContainer::AYukiWaveFunctionCollapseContainer()
@@ -12,46 +51,462 @@ AYukiWaveFunctionCollapseContainer::AYukiWaveFunctionCollapseContainer()
 }
 void AYukiWaveFunctionCollapseContainer::InitWithSolver(UYukiWaveFunctionCollapseSolver* Solver)
 {
-	ClearTiles();
-	Size = Solver->Size;
-	CellSize = Solver->Model->CellSize;
-	for (int i = 0; i < Solver->Cells.Num(); i++)
+	InitForModel(Solver->Model, Solver->Size, Solver->GetSharedRules());
+	UpdateFromSolver(Solver);
+}
+
+void AYukiWaveFunctionCollapseContainer::InitForModel(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> InRules)
+{
+	const int NumCells = InSize.X * InSize.Y * InSize.Z;
+	if (!InRules.IsValid())
+	{
+		InRules = InModel->GetSharedCompiledModel();
+	}
+	// Tiles are shown the way the model shows them now, even if the solver still runs on older rules.
+	const uint64 InVisualHash = InModel->GetCompiledModel().VisualHash;
+	const FIntVector InChunkSize(FMath::Max(MergeChunkSize.X, 1), FMath::Max(MergeChunkSize.Y, 1), FMath::Max(MergeChunkSize.Z, 1));
+	// Spawned tiles are kept only if both their indices and the way they are shown are unchanged.
+	const bool bCompatible = Model == InModel
+		&& Size == InSize
+		&& CellSize == InModel->CellSize
+		&& Rules.IsValid() && Rules->ContentHash == InRules->ContentHash
+		&& VisualHash == InVisualHash
+		&& ChunkSize == InChunkSize
+		&& bMergedTiles == bMergeStaticMeshes
+		&& CellTiles.Num() == NumCells;
+	Rules = MoveTemp(InRules);
+	if (!bCompatible)
 	{
-		const FYukiWaveFunctionCollapseCell& Cell = Solver->Cells[i];
-		if (Cell.Options.Num() != 1)
+		ClearTiles();
+		Model = InModel;
+		Size = InSize;
+		CellSize = InModel->CellSize;
+		VisualHash = InVisualHash;
+		ChunkSize = InChunkSize;
+		bMergedTiles = bMergeStaticMeshes;
+		SyncedStreamSolver.Reset();
+		CellTiles.Init(INDEX_NONE, NumCells);
+		CellComponents.Init(nullptr, NumCells);
+		if (bMergedTiles)
 		{
-			continue;
+			const FIntVector NumChunks = GetNumChunks();
+			const int TotalChunks = NumChunks.X * NumChunks.Y * NumChunks.Z;
+			ChunkComponents.Init(nullptr, TotalChunks);
+			ChunkGenerations.Init(0, TotalChunks);
+			DirtyChunks.Init(false, TotalChunks);
 		}
-		const FGameplayTag& Option = Cell.Options.GetByIndex(0);
-		if (Option == TAG_Empty)
+	}
+}
+
+void AYukiWaveFunctionCollapseContainer::UpdateFromSolver(UYukiWaveFunctionCollapseSolver* Solver)
+{
+	// Tile indices of other rules may be out of range or mean other tiles, start over.
+	if (CellTiles.Num() != Solver->NumCells() || Model != Solver->Model || !Rules.IsValid() || Rules->ContentHash != Solver->GetRules().ContentHash)
+	{
+		InitWithSolver(Solver);
+		return;
+	}
+	TArray<int> ChangedCells;
+	for (int i = 0; i < Solver->NumCells(); i++)
+	{
+		if (CellTiles[i] != Solver->GetCollapsedTileIndex(i))
 		{
-			continue;
+			UpdateCell(Solver, i);
+			ChangedCells.Add(i);
 		}
-		const FYukiWaveFunctionCollapseTileModel& TileModel = Solver->Model->Tiles[Option];
+	}
+	UE_LOG(LogWFC, Verbose, TEXT("Container %s updated %d cells."), *GetName(), ChangedCells.Num());
+	RebuildDirtyChunks();
+	if (bBuildNavGraph)
+	{
+		NavGraph.Update(*Solver);
+	}
+	if (bDirtyNavigationFromCells)
+	{
+		DirtyNavigation(ChangedCells);
+	}
+}
 
-		int X = i % Size.X;
-		int Y = (i / Size.X) % Size.Y;
-		int Z = (i / (Size.X * Size.Y) % Size.Z);
+void AYukiWaveFunctionCollapseContainer::UpdateFromStream(UYukiWaveFunctionCollapseStreamingSolver* Stream, int32 MaxCells)
+{
+	UYukiWaveFunctionCollapseSolver* Solver = Stream->GetSolver();
+	if (!Solver)
+	{
+		return;
+	}
+	// The worker may still be writing the wave, only the model, size and rules are read from the solver. The
+	// worker never replaces the rules.
+	InitForModel(Solver->Model, Solver->Size, Solver->GetSharedRules());
+	if (SyncedStreamSolver == Solver)
+	{
+		// Already brought in line with the finished solve, nothing is published anymore.
+		return;
+	}
+	TArray<FYukiWaveFunctionCollapseStreamedCell> Cells;
+	bool bRestarted;
+	Stream->Poll(MaxCells, Cells, bRestarted);
+	TArray<int> ChangedCells;
+	if (bRestarted)
+	{
+		for (int Cell = 0; Cell < CellTiles.Num(); Cell++)
+		{
+			if (CellTiles[Cell] != INDEX_NONE)
+			{
+				SetCellTile(Cell, INDEX_NONE);
+				ChangedCells.Add(Cell);
+			}
+		}
+	}
+	for (const FYukiWaveFunctionCollapseStreamedCell& Streamed : Cells)
+	{
+		if (CellTiles[Streamed.Cell] != Streamed.Tile)
+		{
+			SetCellTile(Streamed.Cell, Streamed.Tile);
+			ChangedCells.Add(Streamed.Cell);
+		}
+	}
+	UE_LOG(LogWFC, Verbose, TEXT("Container %s streamed %d cells."), *GetName(), Cells.Num());
+	RebuildDirtyChunks();
+	if (bBuildNavGraph)
+	{
+		NavGraph.UpdateCells(*Rules, Size, CellTiles, ChangedCells);
+	}
+	if (bDirtyNavigationFromCells)
+	{
+		DirtyNavigation(ChangedCells);
+	}
+	if (Stream->IsFinished())
+	{
+		UpdateFromSolver(Solver);
+		SyncedStreamSolver = Solver;
+	}
+}
+
+void AYukiWaveFunctionCollapseContainer::UpdateCell(UYukiWaveFunctionCollapseSolver* Solver, int Cell)
+{
+	SetCellTile(Cell, Solver->GetCollapsedTileIndex(Cell));
+}
+
+void AYukiWaveFunctionCollapseContainer::SetCellTile(int Cell, int Tile)
+{
+	if (ChunkComponents.Num() > 0 && (IsMergedTile(CellTiles[Cell]) || IsMergedTile(Tile)))
+	{
+		DirtyChunks[GetChunkIndex(Cell)] = true;
+	}
+	CellTiles[Cell] = Tile;
 
-		FVector BaseLocation = FVector(X * CellSize, Y * CellSize, Z * CellSize);
-		FRotator Rotator = TileModel.Rotation;
-		FTransform Transform = FTransform(Rotator, BaseLocation);
+	const FGameplayTag Option = Tile != INDEX_NONE ? Rules->TileTags[Tile] : FGameplayTag();
+	// Tiles removed from the model since the solver's rules were compiled are left empty.
+	const FYukiWaveFunctionCollapseTileModel* TileModel = Option.IsValid() ? Model->Tiles.Find(Option) : nullptr;
+	UChildActorComponent* TileActor = CellComponents[Cell];
+	if (!TileModel || Option == TAG_Empty || (ChunkComponents.Num() > 0 && IsMergedTile(Tile)))
+	{
+		if (TileActor)
+		{
+			RemoveInstanceComponent(TileActor);
+			TileActor->DestroyComponent();
+			CellComponents[Cell] = nullptr;
+		}
+		return;
+	}
 
-		UChildActorComponent* TileActor = NewObject<UChildActorComponent>(this);
-		TileActor->SetChildActorClass(TileModel.TileActor.LoadSynchronous());
-		AddInstanceComponent(TileActor);
-		FinishAddComponent(TileActor, false, Transform);
-		Tiles.Add(TileActor);
+	const FTransform Transform = GetCellTransform(Cell, *TileModel);
+	UClass* TileClass = TileModel->TileActor.LoadSynchronous();
+	if (TileActor && TileActor->GetChildActorClass() == TileClass)
+	{
+		// Same actor, only the rotation or scale of the variant differs.
+		TileActor->SetRelativeTransform(Transform);
+		return;
 	}
+	if (TileActor)
+	{
+		RemoveInstanceComponent(TileActor);
+		TileActor->DestroyComponent();
+	}
+
+	TileActor = NewObject<UChildActorComponent>(this);
+	TileActor->SetChildActorClass(TileClass);
+	AddInstanceComponent(TileActor);
+	FinishAddComponent(TileActor, false, Transform);
+	CellComponents[Cell] = TileActor;
+}
+
+FTransform AYukiWaveFunctionCollapseContainer::GetCellTransform(int Cell, const FYukiWaveFunctionCollapseTileModel& TileModel) const
+{
+	FVector BaseLocation = GetCellLocation(Model->Topology, Size, Cell) * CellSize;
+	FRotator Rotator = TileModel.Rotation;
+	return FTransform(Rotator, BaseLocation, TileModel.Scale);
 }
 
 void AYukiWaveFunctionCollapseContainer::ClearTiles()
 {
-	for (auto It = Tiles.CreateIterator(); It; ++It)
+	for (auto It = CellComponents.CreateIterator(); It; ++It)
 	{
 		UActorComponent* Component = *It;
-		RemoveInstanceComponent(Component);
-		Component->DestroyComponent();
+		if (Component)
+		{
+			RemoveInstanceComponent(Component);
+			Component->DestroyComponent();
+		}
 		It.RemoveCurrent();
 	}
+	CellTiles.Reset();
+
+	for (UStaticMeshComponent* Component : ChunkComponents)
+	{
+		if (Component)
+		{
+			RemoveInstanceComponent(Component);
+			Component->DestroyComponent();
+		}
+	}
+	ChunkComponents.Reset();
+	// Pending merge jobs see a generation that no longer exists.
+	ChunkGenerations.Reset();
+	DirtyChunks.Reset();
+	MergeSourceMeshes.Reset();
+	MergeSources.Reset();
+	NavGraph.Reset();
+}
+
+bool AYukiWaveFunctionCollapseContainer::IsMergedTile(int Tile) const
+{
+	if (Tile == INDEX_NONE || !Model)
+	{
+		return false;
+	}
+	const FGameplayTag& Option = Rules->TileTags[Tile];
+	const FYukiWaveFunctionCollapseTileModel* TileModel = Model->Tiles.Find(Option);
+	return Option != TAG_Empty && TileModel && !TileModel->StaticMesh.IsNull();
+}
+
+FIntVector AYukiWaveFunctionCollapseContainer::GetNumChunks() const
+{
+	return FIntVector(
+		FMath::DivideAndRoundUp(Size.X, ChunkSize.X),
+		FMath::DivideAndRoundUp(Size.Y, ChunkSize.Y),
+		FMath::DivideAndRoundUp(Size.Z, ChunkSize.Z));
+}
+
+int AYukiWaveFunctionCollapseContainer::GetChunkIndex(int Cell) const
+{
+	const FIntVector NumChunks = GetNumChunks();
+	const int X = Cell % Size.X / ChunkSize.X;
+	const int Y = (Cell / Size.X) % Size.Y / ChunkSize.Y;
+	const int Z = Cell / (Size.X * Size.Y) / ChunkSize.Z;
+	return X + Y * NumChunks.X + Z * NumChunks.X * NumChunks.Y;
+}
+
+FVector AYukiWaveFunctionCollapseContainer::GetChunkOrigin(int Chunk) const
+{
+	// Location of the chunk's first cell, merged tiles are placed relative to it.
+	const FIntVector NumChunks = GetNumChunks();
+	const int X = Chunk % NumChunks.X * ChunkSize.X;
+	const int Y = (Chunk / NumChunks.X) % NumChunks.Y * ChunkSize.Y;
+	const int Z = Chunk / (NumChunks.X * NumChunks.Y) * ChunkSize.Z;
+	return GetCellLocation(Model->Topology, Size, X + (Y * Size.X) + (Z * Size.X * Size.Y)) * CellSize;
+}
+
+TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> AYukiWaveFunctionCollapseContainer::GetMergeSource(UStaticMesh* Mesh)
+{
+	if (!Mesh)
+	{
+		return nullptr;
+	}
+	if (const TSharedPtr<const FYukiWaveFunctionCollapseMergeSource>* Found = MergeSources.Find(Mesh))
+	{
+		return *Found;
+	}
+	TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> Source = FYukiWaveFunctionCollapseMergeSource::Create(*Mesh);
+	MergeSources.Add(Mesh, Source);
+	MergeSourceMeshes.Add(Mesh);
+	return Source;
+}
+
+void AYukiWaveFunctionCollapseContainer::RebuildDirtyChunks()
+{
+	check(IsInGameThread());
+	if (ChunkComponents.Num() == 0)
+	{
+		return;
+	}
+	const FIntVector NumChunks = GetNumChunks();
+	const FIntVector Chunk = ChunkSize;
+	int NumLaunched = 0;
+	for (TConstSetBitIterator<> It(DirtyChunks); It; ++It)
+	{
+		const int ChunkIndex = It.GetIndex();
+		const FIntVector ChunkMin = FIntVector(
+			ChunkIndex % NumChunks.X * Chunk.X,
+			(ChunkIndex / NumChunks.X) % NumChunks.Y * Chunk.Y,
+			ChunkIndex / (NumChunks.X * NumChunks.Y) * Chunk.Z);
+		const FIntVector ChunkMax = FIntVector(FMath::Min(ChunkMin.X + Chunk.X, Size.X), FMath::Min(ChunkMin.Y + Chunk.Y, Size.Y), FMath::Min(ChunkMin.Z + Chunk.Z, Size.Z));
+		const FVector ChunkOrigin = GetChunkOrigin(ChunkIndex);
+
+		// Cells are visited in a fixed order and the key covers everything the merged mesh depends on: the
+		// mesh, rotation and scale of every instance and where it sits in the chunk. Equal chunks of any
+		// map, seed, model or container share one mesh. Odd hex rows are shifted, so the layout of a hex
+		// chunk also depends on the row it starts on.
+		FYukiWaveFunctionCollapseMergeChunk MergeChunk;
+		const int KeySeed[] = {CellSize, (int) Model->Topology, Model->Topology == EYukiWaveFunctionCollapseTopology::HexPrism ? ChunkMin.Y & 1 : 0};
+		uint64 Key = CityHash64(reinterpret_cast<const char*>(KeySeed), sizeof(KeySeed));
+		for (int Z = ChunkMin.Z; Z < ChunkMax.Z; Z++)
+		{
+			for (int Y = ChunkMin.Y; Y < ChunkMax.Y; Y++)
+			{
+				for (int X = ChunkMin.X; X < ChunkMax.X; X++)
+				{
+					const int Cell = X + (Y * Size.X) + (Z * Size.X * Size.Y);
+					const int Tile = CellTiles[Cell];
+					if (!IsMergedTile(Tile))
+					{
+						continue;
+					}
+					const FYukiWaveFunctionCollapseTileModel& TileModel = Model->Tiles[Rules->TileTags[Tile]];
+					TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> Source = GetMergeSource(TileModel.StaticMesh.LoadSynchronous());
+					if (!Source)
+					{
+						continue;
+					}
+					FTransform Transform = GetCellTransform(Cell, TileModel);
+					Transform.AddToTranslation(-ChunkOrigin);
+					MergeChunk.Instances.Add({MoveTemp(Source), Transform});
+
+					const int LocalCell[] = {X - ChunkMin.X, Y - ChunkMin.Y, Z - ChunkMin.Z};
+					Key = CityHash64WithSeed(reinterpret_cast<const char*>(LocalCell), sizeof(LocalCell), Key);
+					Key = YukiWaveFunctionCollapseContainer::HashString(Key, TileModel.StaticMesh.ToString());
+					Key = CityHash64WithSeed(reinterpret_cast<const char*>(&TileModel.Rotation), sizeof(FRotator), Key);
+					Key = CityHash64WithSeed(reinterpret_cast<const char*>(&TileModel.Scale), sizeof(FVector), Key);
+				}
+			}
+		}
+
+		const int Generation = ChunkGenerations[ChunkIndex] = ++MergeGeneration;
+		if (MergeChunk.Instances.Num() == 0)
+		{
+			SetChunkMesh(ChunkIndex, nullptr);
+			continue;
+		}
+		if (const TWeakObjectPtr<UStaticMesh>* Cached = YukiWaveFunctionCollapseContainer::MergedMeshCache.Find(Key))
+		{
+			if (UStaticMesh* CachedMesh = Cached->Get())
+			{
+				SetChunkMesh(ChunkIndex, CachedMesh);
+				continue;
+			}
+			YukiWaveFunctionCollapseContainer::MergedMeshCache.Remove(Key);
+		}
+
+		NumLaunched++;
+		TWeakObjectPtr<AYukiWaveFunctionCollapseContainer> WeakThis(this);
+		Async(EAsyncExecution::ThreadPool, [WeakThis, ChunkIndex, Generation, Key, MergeChunk = MoveTemp(MergeChunk)]() mutable
+		{
+			TSharedRef<FMeshDescription> MeshDescription = MakeShared<FMeshDescription>();
+			MergeChunk.Build(*MeshDescription);
+			AsyncTask(ENamedThreads::GameThread, [WeakThis, ChunkIndex, Generation, Key, MeshDescription, Materials = MoveTemp(MergeChunk.Materials)]()
+			{
+				if (AYukiWaveFunctionCollapseContainer* Container = WeakThis.Get())
+				{
+					Container->OnChunkMerged(ChunkIndex, Generation, Key, *MeshDescription, Materials);
+				}
+			});
+		});
+	}
+	DirtyChunks.Init(false, DirtyChunks.Num());
+	UE_LOG(LogWFC, Verbose, TEXT("Container %s launched %d chunk merges."), *GetName(), NumLaunched);
+}
+
+void AYukiWaveFunctionCollapseContainer::OnChunkMerged(int Chunk, int Generation, uint64 Key, const FMeshDescription& MeshDescription, const TArray<UMaterialInterface*>& Materials)
+{
+	if (!ChunkGenerations.IsValidIndex(Chunk) || ChunkGenerations[Chunk] != Generation)
+	{
+		return;
+	}
+	UStaticMesh* Mesh = NewObject<UStaticMesh>(GetTransientPackage(), NAME_None, RF_Transient);
+	for (int i = 0; i < Materials.Num(); i++)
+	{
+		Mesh->GetStaticMaterials().Add(FStaticMaterial(Materials[i], FName(TEXT("Material"), i)));
+	}
+	UStaticMesh::FBuildMeshDescriptionsParams Params;
+	Params.bBuildSimpleCollision = false;
+	Params.bFastBuild = true;
+	Mesh->BuildFromMeshDescriptions({&MeshDescription}, Params);
+
+	YukiWaveFunctionCollapseContainer::AddMergedMesh(Key, Mesh);
+	SetChunkMesh(Chunk, Mesh);
+}
+
+void AYukiWaveFunctionCollapseContainer::SetChunkMesh(int Chunk, UStaticMesh* Mesh)
+{
+	UStaticMeshComponent* Component = ChunkComponents[Chunk];
+	if (!Mesh)
+	{
+		if (Component)
+		{
+			RemoveInstanceComponent(Component);
+			Component->DestroyComponent();
+			ChunkComponents[Chunk] = nullptr;
+		}
+		return;
+	}
+	if (!Component)
+	{
+		Component = NewObject<UStaticMeshComponent>(this);
+		AddInstanceComponent(Component);
+		FinishAddComponent(Component, false, FTransform(GetChunkOrigin(Chunk)));
+		ChunkComponents[Chunk] = Component;
+	}
+	Component->SetStaticMesh(Mesh);
+}
+
+void AYukiWaveFunctionCollapseContainer::EmptyMergedMeshCache()
+{
+	check(IsInGameThread());
+	YukiWaveFunctionCollapseContainer::MergedMeshCache.Empty();
+	YukiWaveFunctionCollapseContainer::NumMergedMeshesAfterSweep = 0;
+}
+
+bool AYukiWaveFunctionCollapseContainer::FindNavPath(const FVector& From, const FVector& To, TArray<FVector>& OutPath) const
+{
+	OutPath.Reset();
+	if (NavGraph.Num() == 0 || CellSize <= 0)
+	{
+		return false;
+	}
+	const FTransform& ActorTransform = GetActorTransform();
+	const int FromCell = NavGraph.FindNearestCell(ActorTransform.InverseTransformPosition(From) / CellSize);
+	const int ToCell = NavGraph.FindNearestCell(ActorTransform.InverseTransformPosition(To) / CellSize);
+	TArray<int> Cells;
+	if (!NavGraph.FindPath(FromCell, ToCell, Cells))
+	{
+		return false;
+	}
+	OutPath.Reserve(Cells.Num());
+	for (const int Cell : Cells)
+	{
+		OutPath.Add(ActorTransform.TransformPosition(GetCellLocation(Model->Topology, Size, Cell) * CellSize));
+	}
+	return true;
+}
+
+void AYukiWaveFunctionCollapseContainer::DirtyNavigation(TConstArrayView<int> Cells) const
+{
+	UNavigationSystemV1* NavigationSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	if (!NavigationSystem || Cells.Num() == 0)
+	{
+		return;
+	}
+	// Hex cells reach 1/sqrt(3) of a cell from their center, a little more than half a cube.
+	const FVector Extent(CellSize * 0.6f);
+	TMap<int, FBox> ChunkBounds;
+	for (const int Cell : Cells)
+	{
+		const FVector Center = GetCellLocation(Model->Topology, Size, Cell) * CellSize;
+		ChunkBounds.FindOrAdd(GetChunkIndex(Cell), FBox(ForceInit)) += FBox::BuildAABB(Center, Extent);
+	}
+	for (const TPair<int, FBox>& Bounds : ChunkBounds)
+	{
+		NavigationSystem->AddDirtyArea(Bounds.Value.TransformBy(GetActorTransform()), ENavigationDirtyFlag::All);
+	}
+	UE_LOG(LogWFC, Verbose, TEXT("Container %s dirtied %d navigation areas."), *GetName(), ChunkBounds.Num());
 }
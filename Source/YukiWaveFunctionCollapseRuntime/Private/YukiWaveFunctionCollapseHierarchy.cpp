@@ -0,0 +1,327 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseHierarchy.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Async/ParallelFor.h"
+#include <atomic>
+
+DECLARE_CYCLE_STAT(TEXT("Hierarchy Blocks"), STAT_YukiWFC_HierarchyBlocks, STATGROUP_YukiWFC);
+DECLARE_CYCLE_STAT(TEXT("Hierarchy Stitch"), STAT_YukiWFC_HierarchyStitch, STATGROUP_YukiWFC);
+
+namespace YukiWaveFunctionCollapseHierarchy
+{
+	// Seeds only depend on the hierarchy seed and the block, so results do not depend on the worker count.
+	int32 GetBlockSeed(int32 Seed, int Block, int Attempt)
+	{
+		return (int32) HashCombine(HashCombine(GetTypeHash(Seed), GetTypeHash(Block)), GetTypeHash(Attempt));
+	}
+}
+
+void UYukiWaveFunctionCollapseHierarchy::BuildFineMasks(TArray<uint64>& OutMasks)
+{
+	check(CoarseModel && FineModel);
+	const FYukiWaveFunctionCollapseCompiledModel& Coarse = CoarseModel->GetCompiledModel();
+	const FYukiWaveFunctionCollapseCompiledModel& Fine = FineModel->GetCompiledModel();
+	const int NumWords = Fine.NumWords;
+	OutMasks.Init(0, Coarse.NumTiles() * NumWords);
+	TArray<uint64> Matching;
+	Matching.SetNumUninitialized(NumWords);
+	for (int CoarseTile = 0; CoarseTile < Coarse.NumTiles(); CoarseTile++)
+	{
+		uint64* Mask = OutMasks.GetData() + CoarseTile * NumWords;
+		const FGameplayTagContainer* Allowed = AllowedFineTiles.Find(Coarse.TileTags[CoarseTile]);
+		if (!Allowed)
+		{
+			FMemory::Memcpy(Mask, Fine.AllMask.GetData(), NumWords * sizeof(uint64));
+			continue;
+		}
+		for (const FGameplayTag& Tag : *Allowed)
+		{
+			Fine.GetMatchingMask(Tag, Matching.GetData());
+			for (int Word = 0; Word < NumWords; Word++)
+			{
+				Mask[Word] |= Matching[Word];
+			}
+		}
+		bool bAny = false;
+		for (int Word = 0; Word < NumWords; Word++)
+		{
+			bAny |= Mask[Word] != 0;
+		}
+		if (!bAny)
+		{
+			UE_LOG(LogWFC, Warning, TEXT("%s: no fine tile of %s matches the tiles allowed under %s."), *GetName(), *FineModel->GetName(), *Coarse.TileTags[CoarseTile].ToString());
+		}
+	}
+}
+
+void UYukiWaveFunctionCollapseHierarchicalSolver::Init(UYukiWaveFunctionCollapseHierarchy* InHierarchy, FIntVector InCoarseSize, int32 InSeed)
+{
+	check(InHierarchy && InHierarchy->CoarseModel && InHierarchy->FineModel);
+	Hierarchy = InHierarchy;
+	CoarseSize = InCoarseSize;
+	Seed = InSeed;
+
+	// Block solvers run on worker threads, they all solve with the fine rules published now.
+	FineRules = Hierarchy->FineModel->GetSharedCompiledModel();
+	const FYukiWaveFunctionCollapseCompiledModel& Fine = *FineRules;
+
+	CoarseSolver = NewObject<UYukiWaveFunctionCollapseSolver>(this);
+	CoarseSolver->Init(Hierarchy->CoarseModel, CoarseSize, FRandomStream(Seed));
+	FineSolver = NewObject<UYukiWaveFunctionCollapseSolver>(this);
+
+	Hierarchy->BuildFineMasks(FineMasks);
+	const int NumWords = Fine.NumWords;
+	const int NumCoarseTiles = FineMasks.Num() / NumWords;
+	const int NumDirections = (int) EYDWaveFunctionDirection::MAX;
+	SupportMasks.Init(0, NumCoarseTiles * NumDirections * NumWords);
+	for (int CoarseTile = 0; CoarseTile < NumCoarseTiles; CoarseTile++)
+	{
+		const uint64* FineMask = FineMasks.GetData() + CoarseTile * NumWords;
+		for (int Direction = 0; Direction < NumDirections; Direction++)
+		{
+			uint64* Support = SupportMasks.GetData() + (CoarseTile * NumDirections + Direction) * NumWords;
+			for (int Tile = 0; Tile < Fine.NumTiles(); Tile++)
+			{
+				if (FineMask[Tile / 64] & (1ull << (Tile % 64)))
+				{
+					const uint64* Row = Fine.GetPropagatorRow((EYDWaveFunctionDirection) Direction, Tile);
+					for (int Word = 0; Word < NumWords; Word++)
+					{
+						Support[Word] |= Row[Word];
+					}
+				}
+			}
+		}
+	}
+
+	// One solver per worker, created here to keep UObject creation on the game thread.
+	const int NumBlocks = CoarseSize.X * CoarseSize.Y * CoarseSize.Z;
+	const int NumWorkers = FMath::Clamp(FTaskGraphInterface::Get().GetNumWorkerThreads() + 1, 1, FMath::Max(NumBlocks, 1));
+	BlockSolvers.Reset();
+	for (int i = 0; i < NumWorkers; i++)
+	{
+		BlockSolvers.Add(NewObject<UYukiWaveFunctionCollapseSolver>(this));
+	}
+	BlockTiles.Reset();
+	SolvedBlocks.Reset();
+	NumFailedBlocks = 0;
+}
+
+FIntVector UYukiWaveFunctionCollapseHierarchicalSolver::GetFineSize() const
+{
+	const FIntVector BlockSize = Hierarchy->BlockSize;
+	return FIntVector(CoarseSize.X * BlockSize.X, CoarseSize.Y * BlockSize.Y, CoarseSize.Z * BlockSize.Z);
+}
+
+FIntVector UYukiWaveFunctionCollapseHierarchicalSolver::GetBlockOrigin(int Block) const
+{
+	const FIntVector BlockSize = Hierarchy->BlockSize;
+	const int X = Block % CoarseSize.X;
+	const int Y = (Block / CoarseSize.X) % CoarseSize.Y;
+	const int Z = Block / (CoarseSize.X * CoarseSize.Y);
+	return FIntVector(X * BlockSize.X, Y * BlockSize.Y, Z * BlockSize.Z);
+}
+
+bool UYukiWaveFunctionCollapseHierarchicalSolver::SolveFully()
+{
+	check(Hierarchy && CoarseSolver);
+	if (Hierarchy->CoarseModel->Topology != EYukiWaveFunctionCollapseTopology::Cube || Hierarchy->FineModel->Topology != EYukiWaveFunctionCollapseTopology::Cube)
+	{
+		UE_LOG(LogWFC, Error, TEXT("%s: hierarchical solves only support Cube topologies."), *Hierarchy->GetName());
+		return false;
+	}
+	CoarseSolver->SolveFully();
+	if (!CoarseSolver->IsSolved())
+	{
+		UE_LOG(LogWFC, Error, TEXT("%s: the coarse layout of size %s could not be solved."), *Hierarchy->GetName(), *CoarseSize.ToString());
+		return false;
+	}
+	SolveBlocks();
+	StitchBlocks();
+	return FineSolver->IsSolved();
+}
+
+bool UYukiWaveFunctionCollapseHierarchicalSolver::SolveBlocks()
+{
+	using namespace YukiWaveFunctionCollapseHierarchy;
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_HierarchyBlocks);
+
+	const FIntVector BlockSize = Hierarchy->BlockSize;
+	const FIntVector FineSize = GetFineSize();
+	const int NumBlocks = CoarseSolver->NumCells();
+	BlockTiles.Init(INDEX_NONE, FineSize.X * FineSize.Y * FineSize.Z);
+	SolvedBlocks.Init(false, NumBlocks);
+	for (UYukiWaveFunctionCollapseSolver* Solver : BlockSolvers)
+	{
+		Solver->MaxRestarts = MaxBlockRestarts;
+	}
+
+	// Checkerboard phases: blocks of a phase share no face, so they are solved independently and the
+	// second phase sees the final tiles of every neighbor.
+	for (int Phase = 0; Phase < 2; Phase++)
+	{
+		TArray<int> Blocks;
+		for (int Block = 0; Block < NumBlocks; Block++)
+		{
+			const int Parity = Block % CoarseSize.X + (Block / CoarseSize.X) % CoarseSize.Y + Block / (CoarseSize.X * CoarseSize.Y);
+			if ((Parity & 1) == Phase)
+			{
+				Blocks.Add(Block);
+			}
+		}
+
+		std::atomic<int32> NextBlock = 0;
+		ParallelFor(BlockSolvers.Num(), [&](int32 Worker)
+		{
+			UYukiWaveFunctionCollapseSolver* Solver = BlockSolvers[Worker];
+			TArray<uint64> Masks;
+			for (int32 i = NextBlock++; i < Blocks.Num(); i = NextBlock++)
+			{
+				const int Block = Blocks[i];
+				BuildBlockMasks(Block, Masks);
+				const uint32 Borders = GetBlockBorders(Block);
+				for (int Attempt = 0; Attempt < MaxBlockAttempts; Attempt++)
+				{
+					Solver->InitConstrained(Hierarchy->FineModel, BlockSize, GetBlockSeed(Seed, Block, Attempt), Borders, Masks, FineRules);
+					if (Solver->HasContradiction())
+					{
+						// The masks alone are unsatisfiable, no seed will help.
+						break;
+					}
+					Solver->SolveFully();
+					if (!Solver->IsSolved())
+					{
+						continue;
+					}
+					const FIntVector Origin = GetBlockOrigin(Block);
+					for (int Cell = 0; Cell < Solver->NumCells(); Cell++)
+					{
+						const int X = Origin.X + Cell % BlockSize.X;
+						const int Y = Origin.Y + (Cell / BlockSize.X) % BlockSize.Y;
+						const int Z = Origin.Z + Cell / (BlockSize.X * BlockSize.Y);
+						BlockTiles[X + Y * FineSize.X + Z * FineSize.X * FineSize.Y] = Solver->GetCollapsedTileIndex(Cell);
+					}
+					SolvedBlocks[Block] = true;
+					break;
+				}
+			}
+		});
+	}
+
+	NumFailedBlocks = 0;
+	for (const bool bSolved : SolvedBlocks)
+	{
+		NumFailedBlocks += bSolved ? 0 : 1;
+	}
+	UE_LOG(LogWFC, Log, TEXT("%s: solved %d of %d blocks."), *Hierarchy->GetName(), NumBlocks - NumFailedBlocks, NumBlocks);
+	return NumFailedBlocks == 0;
+}
+
+void UYukiWaveFunctionCollapseHierarchicalSolver::BuildBlockMasks(int Block, TArray<uint64>& OutMasks) const
+{
+	const FYukiWaveFunctionCollapseCompiledModel& Fine = *FineRules;
+	const int NumWords = Fine.NumWords;
+	const int NumDirections = (int) EYDWaveFunctionDirection::MAX;
+	const FIntVector BlockSize = Hierarchy->BlockSize;
+	const FIntVector FineSize = GetFineSize();
+	const FIntVector Origin = GetBlockOrigin(Block);
+	const int NumCells = BlockSize.X * BlockSize.Y * BlockSize.Z;
+
+	const uint64* FineMask = FineMasks.GetData() + CoarseSolver->GetCollapsedTileIndex(Block) * NumWords;
+	OutMasks.SetNumUninitialized(NumCells * NumWords);
+	for (int Cell = 0; Cell < NumCells; Cell++)
+	{
+		FMemory::Memcpy(OutMasks.GetData() + Cell * NumWords, FineMask, NumWords * sizeof(uint64));
+	}
+
+	for (int i = 0; i < NumDirections; i++)
+	{
+		const EYDWaveFunctionDirection Direction = (EYDWaveFunctionDirection) i;
+		const EYDWaveFunctionDirection Opposite = GetOppositeDirection(Direction);
+		int NeighborBlock;
+		if (!GetNeighborCell(CoarseSize, Block, Direction, NeighborBlock))
+		{
+			continue;
+		}
+		const uint64* Support = SupportMasks.GetData() + (CoarseSolver->GetCollapsedTileIndex(NeighborBlock) * NumDirections + (int) Opposite) * NumWords;
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			int Inside;
+			if (GetNeighborCell(BlockSize, Cell, Direction, Inside))
+			{
+				continue;
+			}
+			const int X = Origin.X + Cell % BlockSize.X;
+			const int Y = Origin.Y + (Cell / BlockSize.X) % BlockSize.Y;
+			const int Z = Origin.Z + Cell / (BlockSize.X * BlockSize.Y);
+			int FineNeighbor;
+			verify(GetNeighborCell(FineSize, X + Y * FineSize.X + Z * FineSize.X * FineSize.Y, Direction, FineNeighbor));
+			const uint64* Allowed = SolvedBlocks[NeighborBlock] ? Fine.GetPropagatorRow(Opposite, BlockTiles[FineNeighbor]) : Support;
+			uint64* Mask = OutMasks.GetData() + Cell * NumWords;
+			for (int Word = 0; Word < NumWords; Word++)
+			{
+				Mask[Word] &= Allowed[Word];
+			}
+		}
+	}
+}
+
+uint32 UYukiWaveFunctionCollapseHierarchicalSolver::GetBlockBorders(int Block) const
+{
+	// Model borders only apply where the block touches the edge of the fine grid.
+	uint32 Borders = 0;
+	for (int i = 0; i < (int) EYDWaveFunctionDirection::MAX; i++)
+	{
+		int NeighborBlock;
+		if (!GetNeighborCell(CoarseSize, Block, (EYDWaveFunctionDirection) i, NeighborBlock))
+		{
+			Borders |= 1u << i;
+		}
+	}
+	return Borders;
+}
+
+void UYukiWaveFunctionCollapseHierarchicalSolver::StitchBlocks()
+{
+	using namespace YukiWaveFunctionCollapseHierarchy;
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_HierarchyStitch);
+
+	const FYukiWaveFunctionCollapseCompiledModel& Fine = *FineRules;
+	const int NumWords = Fine.NumWords;
+	TArray<uint64> Masks;
+	Masks.Init(0, BlockTiles.Num() * NumWords);
+	for (int Cell = 0; Cell < BlockTiles.Num(); Cell++)
+	{
+		uint64* Mask = Masks.GetData() + Cell * NumWords;
+		const int Tile = BlockTiles[Cell];
+		if (Tile != INDEX_NONE)
+		{
+			Mask[Tile / 64] = 1ull << (Tile % 64);
+		}
+		else
+		{
+			FMemory::Memcpy(Mask, Fine.AllMask.GetData(), NumWords * sizeof(uint64));
+		}
+	}
+	FineSolver->InitConstrained(Hierarchy->FineModel, GetFineSize(), Seed, MAX_uint32, Masks, FineRules);
+
+	// Failed blocks are solved inside the grid, first alone, then together with the blocks around them.
+	const FIntVector BlockSize = Hierarchy->BlockSize;
+	for (int Block = 0; Block < SolvedBlocks.Num(); Block++)
+	{
+		if (SolvedBlocks[Block])
+		{
+			continue;
+		}
+		const FIntVector Min = GetBlockOrigin(Block);
+		const int32 BlockSeed = GetBlockSeed(Seed, Block, MaxBlockAttempts);
+		if (!FineSolver->ResolveRegion(Min, Min + BlockSize, BlockSeed, MaxFallbackBacktracks))
+		{
+			FineSolver->ResolveRegion(Min - BlockSize, Min + BlockSize * 2, BlockSeed, MaxFallbackBacktracks);
+		}
+	}
+}
@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseMeshMerge.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "Engine/StaticMesh.h"
+#include "StaticMeshAttributes.h"
+#include "StaticMeshResources.h"
+
+TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> FYukiWaveFunctionCollapseMergeSource::Create(UStaticMesh& Mesh)
+{
+	check(IsInGameThread());
+	const FStaticMeshRenderData* RenderData = Mesh.GetRenderData();
+	if (!RenderData || RenderData->LODResources.Num() == 0)
+	{
+		UE_LOG(LogWFC, Warning, TEXT("Cannot merge %s, it has no render data."), *Mesh.GetName());
+		return nullptr;
+	}
+	const FStaticMeshLODResources& LOD = RenderData->LODResources[0];
+	const FPositionVertexBuffer& PositionBuffer = LOD.VertexBuffers.PositionVertexBuffer;
+	const FStaticMeshVertexBuffer& VertexBuffer = LOD.VertexBuffers.StaticMeshVertexBuffer;
+	if (FPlatformProperties::RequiresCookedData() && !Mesh.bAllowCPUAccess)
+	{
+		UE_LOG(LogWFC, Warning, TEXT("Cannot merge %s, it needs Allow CPU Access in cooked builds."), *Mesh.GetName());
+		return nullptr;
+	}
+
+	const TSharedPtr<FYukiWaveFunctionCollapseMergeSource> Source = MakeShared<FYukiWaveFunctionCollapseMergeSource>();
+	const int NumVertices = PositionBuffer.GetNumVertices();
+	Source->Positions.SetNumUninitialized(NumVertices);
+	Source->Normals.SetNumUninitialized(NumVertices);
+	Source->Tangents.SetNumUninitialized(NumVertices);
+	Source->BinormalSigns.SetNumUninitialized(NumVertices);
+	Source->UVs.SetNumUninitialized(NumVertices);
+	const bool bHasUVs = VertexBuffer.GetNumTexCoords() > 0;
+	for (int Vertex = 0; Vertex < NumVertices; Vertex++)
+	{
+		const FVector4f TangentZ = VertexBuffer.VertexTangentZ(Vertex);
+		Source->Positions[Vertex] = PositionBuffer.VertexPosition(Vertex);
+		Source->Normals[Vertex] = FVector3f(TangentZ);
+		Source->Tangents[Vertex] = FVector3f(VertexBuffer.VertexTangentX(Vertex));
+		Source->BinormalSigns[Vertex] = TangentZ.W < 0.0f ? -1.0f : 1.0f;
+		Source->UVs[Vertex] = bHasUVs ? VertexBuffer.GetVertexUV(Vertex, 0) : FVector2f::ZeroVector;
+	}
+	LOD.IndexBuffer.GetCopy(Source->Indices);
+
+	for (const FStaticMeshSection& Section : LOD.Sections)
+	{
+		FSection& MergeSection = Source->Sections.AddDefaulted_GetRef();
+		MergeSection.Material = Mesh.GetMaterial(Section.MaterialIndex);
+		MergeSection.FirstIndex = Section.FirstIndex;
+		MergeSection.NumTriangles = Section.NumTriangles;
+	}
+	return Source;
+}
+
+void FYukiWaveFunctionCollapseMergeChunk::Build(FMeshDescription& OutMesh)
+{
+	FStaticMeshAttributes Attributes(OutMesh);
+	Attributes.Register();
+	TVertexAttributesRef<FVector3f> Positions = Attributes.GetVertexPositions();
+	TVertexInstanceAttributesRef<FVector3f> Normals = Attributes.GetVertexInstanceNormals();
+	TVertexInstanceAttributesRef<FVector3f> Tangents = Attributes.GetVertexInstanceTangents();
+	TVertexInstanceAttributesRef<float> BinormalSigns = Attributes.GetVertexInstanceBinormalSigns();
+	TVertexInstanceAttributesRef<FVector2f> UVs = Attributes.GetVertexInstanceUVs();
+	TPolygonGroupAttributesRef<FName> SlotNames = Attributes.GetPolygonGroupMaterialSlotNames();
+
+	int NumVertices = 0;
+	int NumTriangles = 0;
+	Materials.Reset();
+	for (const FInstance& Instance : Instances)
+	{
+		NumVertices += Instance.Source->Positions.Num();
+		for (const FYukiWaveFunctionCollapseMergeSource::FSection& Section : Instance.Source->Sections)
+		{
+			NumTriangles += Section.NumTriangles;
+			Materials.AddUnique(Section.Material);
+		}
+	}
+	OutMesh.ReserveNewVertices(NumVertices);
+	OutMesh.ReserveNewVertexInstances(NumVertices);
+	OutMesh.ReserveNewTriangles(NumTriangles);
+	OutMesh.ReserveNewPolygonGroups(Materials.Num());
+
+	TArray<FPolygonGroupID> Groups;
+	for (int i = 0; i < Materials.Num(); i++)
+	{
+		const FPolygonGroupID Group = OutMesh.CreatePolygonGroup();
+		SlotNames[Group] = FName(TEXT("Material"), i);
+		Groups.Add(Group);
+	}
+
+	TArray<FVertexInstanceID> Remap;
+	for (const FInstance& Instance : Instances)
+	{
+		const FYukiWaveFunctionCollapseMergeSource& Source = *Instance.Source;
+		const FTransform3f Transform(Instance.Transform);
+		const FQuat4f Rotation = Transform.GetRotation();
+		const FVector3f InverseScale = Transform.GetScale3D().Reciprocal();
+		// Mirroring scales flip the winding.
+		const bool bFlip = Transform.GetDeterminant() < 0.0f;
+
+		// Vertices are created on first use, so unused vertices of the source are skipped.
+		Remap.Init(FVertexInstanceID::Invalid, Source.Positions.Num());
+		auto GetVertexInstance = [&](uint32 Vertex)
+		{
+			if (Remap[Vertex] == FVertexInstanceID::Invalid)
+			{
+				const FVertexID NewVertex = OutMesh.CreateVertex();
+				Positions[NewVertex] = Transform.TransformPosition(Source.Positions[Vertex]);
+				const FVertexInstanceID NewInstance = OutMesh.CreateVertexInstance(NewVertex);
+				// Inverse transpose of a TRS transform, keeps normals perpendicular under non-uniform scale.
+				Normals[NewInstance] = Rotation.RotateVector(Source.Normals[Vertex] * InverseScale).GetSafeNormal();
+				Tangents[NewInstance] = Transform.TransformVector(Source.Tangents[Vertex]).GetSafeNormal();
+				BinormalSigns[NewInstance] = bFlip ? -Source.BinormalSigns[Vertex] : Source.BinormalSigns[Vertex];
+				UVs.Set(NewInstance, 0, Source.UVs[Vertex]);
+				Remap[Vertex] = NewInstance;
+			}
+			return Remap[Vertex];
+		};
+
+		for (const FYukiWaveFunctionCollapseMergeSource::FSection& Section : Source.Sections)
+		{
+			const FPolygonGroupID Group = Groups[Materials.IndexOfByKey(Section.Material)];
+			for (int Triangle = 0; Triangle < Section.NumTriangles; Triangle++)
+			{
+				const int First = Section.FirstIndex + Triangle * 3;
+				FVertexInstanceID Corners[3] = {
+					GetVertexInstance(Source.Indices[First]),
+					GetVertexInstance(Source.Indices[First + 1]),
+					GetVertexInstance(Source.Indices[First + 2]),
+				};
+				if (bFlip)
+				{
+					Swap(Corners[1], Corners[2]);
+				}
+				OutMesh.CreateTriangle(Group, Corners);
+			}
+		}
+	}
+}
@@ -0,0 +1,211 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseMetrics.h"
+
+#include "YukiWaveFunctionCollapseModel.h"
+
+namespace YukiWaveFunctionCollapseMetrics
+{
+	int FindRoot(TArray<int>& Parents, int Cell)
+	{
+		while (Parents[Cell] != Cell)
+		{
+			// Path halving.
+			Parents[Cell] = Parents[Parents[Cell]];
+			Cell = Parents[Cell];
+		}
+		return Cell;
+	}
+
+	// Sums the tiles matching Tag, including child tags.
+	int CountMatching(const FYukiWaveFunctionCollapseCompiledModel& Rules, const TArray<int>& TileCounts, const FGameplayTag& Tag)
+	{
+		int Count = 0;
+		for (int Tile = 0; Tile < Rules.NumTiles(); Tile++)
+		{
+			if (Rules.TileTags[Tile].MatchesTag(Tag))
+			{
+				Count += TileCounts[Tile];
+			}
+		}
+		return Count;
+	}
+}
+
+FYukiWaveFunctionCollapseMetrics FYukiWaveFunctionCollapseMetrics::Compute(const UYukiWaveFunctionCollapseSolver& Solver, const FYukiWaveFunctionCollapseMetricsSettings& Settings)
+{
+	using namespace YukiWaveFunctionCollapseMetrics;
+
+	FYukiWaveFunctionCollapseMetrics Metrics;
+	const FYukiWaveFunctionCollapseCompiledModel& Rules = Solver.GetRules();
+	const FIntVector Size = Solver.Size;
+	const int NumCells = Solver.NumCells();
+	const int NumTiles = Rules.NumTiles();
+
+	// Per tile lookups, so the pass over the cells does not touch tags.
+	enum : uint8 { StartFlag = 1, EndFlag = 2 };
+	TArray<uint8> TileFlags;
+	TileFlags.Init(0, NumTiles);
+	for (int Tile = 0; Tile < NumTiles; Tile++)
+	{
+		TileFlags[Tile] |= Settings.StartMarker.IsValid() && Rules.TileTags[Tile].MatchesTag(Settings.StartMarker) ? StartFlag : 0;
+		TileFlags[Tile] |= Settings.EndMarker.IsValid() && Rules.TileTags[Tile].MatchesTag(Settings.EndMarker) ? EndFlag : 0;
+	}
+	const bool bPath = Settings.StartMarker.IsValid() && Settings.EndMarker.IsValid();
+
+	TArray<int> TileCounts;
+	TileCounts.Init(0, NumTiles);
+	TArray<int> Tiles;
+	Tiles.SetNumUninitialized(NumCells);
+	// INDEX_NONE for cells that are not walkable, the union-find parent otherwise.
+	TArray<int> Parents;
+	if (Settings.bRegions)
+	{
+		Parents.Init(INDEX_NONE, NumCells);
+	}
+	int StartCell = INDEX_NONE;
+	TBitArray<> EndCells;
+	if (bPath)
+	{
+		EndCells.Init(false, NumCells);
+	}
+
+	const TConstArrayView<EYDWaveFunctionDirection> Directions = GetTopologyDirections(Rules.Topology);
+	for (int Cell = 0; Cell < NumCells; Cell++)
+	{
+		const int Tile = Solver.GetCollapsedTileIndex(Cell);
+		Tiles[Cell] = Tile;
+		if (Tile == INDEX_NONE)
+		{
+			Metrics.UncollapsedCells++;
+			continue;
+		}
+		TileCounts[Tile]++;
+
+		if (TileFlags[Tile] & StartFlag && StartCell == INDEX_NONE)
+		{
+			StartCell = Cell;
+		}
+		if (TileFlags[Tile] & EndFlag)
+		{
+			EndCells[Cell] = true;
+		}
+
+		const uint32 Walk = Rules.WalkDirections[Tile];
+		if (Walk == 0)
+		{
+			continue;
+		}
+		Metrics.WalkableCells++;
+		if (!Settings.bRegions)
+		{
+			continue;
+		}
+		// Join the regions of neighbors that were already visited. Every direction is checked, wrapping grids
+		// also have visited neighbors ahead of the cell.
+		Parents[Cell] = Cell;
+		for (const EYDWaveFunctionDirection Direction : Directions)
+		{
+			int Neighbor;
+			if (!GetNeighborCell(Rules.Topology, Size, Cell, Direction, Neighbor) || Parents[Neighbor] == INDEX_NONE)
+			{
+				continue;
+			}
+			const uint32 NeighborWalk = Rules.WalkDirections[Tiles[Neighbor]];
+			if ((Walk & (1u << (uint32) Direction)) || (NeighborWalk & (1u << (uint32) GetOppositeDirection(Direction))))
+			{
+				const int A = FindRoot(Parents, Cell);
+				const int B = FindRoot(Parents, Neighbor);
+				if (A != B)
+				{
+					Parents[FMath::Max(A, B)] = FMath::Min(A, B);
+				}
+			}
+		}
+	}
+
+	Metrics.WalkableCoverage = NumCells > 0 ? (float) Metrics.WalkableCells / NumCells : 0.0f;
+	if (Settings.bRegions)
+	{
+		TArray<int> RegionSizes;
+		RegionSizes.Init(0, NumCells);
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			if (Parents[Cell] != INDEX_NONE)
+			{
+				const int Root = FindRoot(Parents, Cell);
+				Metrics.NumRegions += RegionSizes[Root] == 0 ? 1 : 0;
+				Metrics.LargestRegion = FMath::Max(Metrics.LargestRegion, ++RegionSizes[Root]);
+			}
+		}
+	}
+
+	if (Settings.bTileHistogram)
+	{
+		for (int Tile = 0; Tile < NumTiles; Tile++)
+		{
+			if (TileCounts[Tile] > 0)
+			{
+				Metrics.TileCounts.Add(Rules.TileTags[Tile], TileCounts[Tile]);
+			}
+		}
+	}
+
+	const int NumCollapsed = NumCells - Metrics.UncollapsedCells;
+	float TotalWeight = 0.0f;
+	for (const TPair<FGameplayTag, float>& Target : Settings.TargetHistogram)
+	{
+		TotalWeight += FMath::Max(Target.Value, 0.0f);
+	}
+	if (TotalWeight > 0.0f && NumCollapsed > 0)
+	{
+		float Distance = 0.0f;
+		for (const TPair<FGameplayTag, float>& Target : Settings.TargetHistogram)
+		{
+			const float Share = (float) CountMatching(Rules, TileCounts, Target.Key) / NumCollapsed;
+			Distance += FMath::Abs(Share - FMath::Max(Target.Value, 0.0f) / TotalWeight);
+		}
+		Metrics.HistogramError = FMath::Min(Distance * 0.5f, 1.0f);
+	}
+
+	for (const TPair<FGameplayTag, int32>& MinCount : Settings.MinCounts)
+	{
+		if (CountMatching(Rules, TileCounts, MinCount.Key) < MinCount.Value)
+		{
+			Metrics.bMeetsMinCounts = false;
+			break;
+		}
+	}
+
+	// Breadth first over walk directions, the first end cell reached is the closest.
+	if (bPath && StartCell != INDEX_NONE)
+	{
+		TArray<int> Distances;
+		Distances.Init(INDEX_NONE, NumCells);
+		TArray<int> Queue;
+		Queue.Reserve(Metrics.WalkableCells + 1);
+		Queue.Add(StartCell);
+		Distances[StartCell] = 0;
+		for (int Head = 0; Head < Queue.Num(); Head++)
+		{
+			const int Cell = Queue[Head];
+			if (EndCells[Cell])
+			{
+				Metrics.PathLength = Distances[Cell];
+				break;
+			}
+			const uint32 Walk = Rules.WalkDirections[Tiles[Cell]];
+			for (const EYDWaveFunctionDirection Direction : Directions)
+			{
+				int Neighbor;
+				if ((Walk & (1u << (uint32) Direction)) && GetNeighborCell(Rules.Topology, Size, Cell, Direction, Neighbor) && Tiles[Neighbor] != INDEX_NONE && Distances[Neighbor] == INDEX_NONE)
+				{
+					Distances[Neighbor] = Distances[Cell] + 1;
+					Queue.Add(Neighbor);
+				}
+			}
+		}
+	}
+	return Metrics;
+}
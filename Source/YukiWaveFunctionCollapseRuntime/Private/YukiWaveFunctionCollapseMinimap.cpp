@@ -0,0 +1,320 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseMinimap.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Async/ParallelFor.h"
+#include "Engine/Texture2D.h"
+#include "Hash/CityHash.h"
+#include "Misc/App.h"
+
+DECLARE_CYCLE_STAT(TEXT("Minimap Atlas"), STAT_YukiWFC_MinimapAtlas, STATGROUP_YukiWFC);
+DECLARE_CYCLE_STAT(TEXT("Minimap Blit"), STAT_YukiWFC_MinimapBlit, STATGROUP_YukiWFC);
+
+namespace YukiWaveFunctionCollapseMinimap
+{
+	// Atlases by (rules content hash, brush hash, brush size). Game thread only.
+	TMap<TTuple<uint64, uint64, int>, TSharedPtr<const FYukiWaveFunctionCollapseBrushAtlas>> AtlasCache;
+
+	int GetBrushQuarters(const FYukiWaveFunctionCollapseTileModel& TileModel)
+	{
+		return FMath::RoundToInt(FRotator::NormalizeAxis(TileModel.Rotation.Yaw) / 90.0f) & 3;
+	}
+
+	// Hash of everything an atlas is drawn from besides the tile order: brush paths and quarter turns.
+	uint64 ComputeBrushHash(const UYukiWaveFunctionCollapseModel& Model, const FYukiWaveFunctionCollapseCompiledModel& Rules)
+	{
+		uint64 Hash = 0;
+		for (const FGameplayTag& Tag : Rules.TileTags)
+		{
+			const FYukiWaveFunctionCollapseTileModel* TileModel = Model.Tiles.Find(Tag);
+			const FString Path = TileModel ? TileModel->BrushTexture.ToString() : FString();
+			const int Quarters = TileModel ? GetBrushQuarters(*TileModel) : 0;
+			Hash = CityHash64WithSeed(reinterpret_cast<const char*>(*Path), Path.Len() * sizeof(TCHAR), Hash);
+			Hash = CityHash64WithSeed(reinterpret_cast<const char*>(&Quarters), sizeof(Quarters), Hash);
+		}
+		return Hash;
+	}
+
+	// Cells per layer above which redrawn cells are split across workers.
+	constexpr int ParallelBlitThreshold = 64;
+}
+
+void UYukiWaveFunctionCollapseMinimap::Build(UYukiWaveFunctionCollapseSolver* Solver)
+{
+	check(Solver && Solver->Model);
+	const FYukiWaveFunctionCollapseCompiledModel& Rules = Solver->GetRules();
+	const bool bCompatible = Model == Solver->Model
+		&& Size == Solver->Size
+		&& RulesHash == Rules.ContentHash
+		&& VisualHash == Solver->Model->GetCompiledModel().VisualHash
+		&& Atlas && Atlas->BrushSize == BrushSize;
+	if (!bCompatible)
+	{
+		Model = Solver->Model;
+		Size = Solver->Size;
+		RulesHash = Rules.ContentHash;
+		VisualHash = Model->GetCompiledModel().VisualHash;
+		Atlas = GetAtlas(*Model, Solver->GetSharedRules(), BrushSize);
+
+		const int LayerPixels = GetLayerWidth() * GetLayerHeight();
+		Layers.SetNum(Size.Z);
+		for (TArray<FColor>& Layer : Layers)
+		{
+			Layer.Init(BackgroundColor, LayerPixels);
+		}
+		LayerTextures.Reset();
+		LayerTextures.SetNum(Size.Z);
+		DirtyLayers.Init(true, Size.Z);
+	}
+
+	TArray<int> Cells;
+	Cells.SetNumUninitialized(Solver->NumCells());
+	CellTiles.SetNumUninitialized(Solver->NumCells());
+	for (int i = 0; i < Solver->NumCells(); i++)
+	{
+		Cells[i] = i;
+		CellTiles[i] = Solver->GetCollapsedTileIndex(i);
+	}
+	BlitCells(Cells);
+	UploadDirtyLayers();
+}
+
+void UYukiWaveFunctionCollapseMinimap::UpdateFromSolver(UYukiWaveFunctionCollapseSolver* Solver)
+{
+	check(Solver);
+	if (CellTiles.Num() != Solver->NumCells() || Model != Solver->Model || RulesHash != Solver->GetRules().ContentHash
+		|| VisualHash != Solver->Model->GetCompiledModel().VisualHash || !Atlas || Atlas->BrushSize != BrushSize)
+	{
+		Build(Solver);
+		return;
+	}
+	TArray<int> Changed;
+	for (int i = 0; i < Solver->NumCells(); i++)
+	{
+		const int Tile = Solver->GetCollapsedTileIndex(i);
+		if (CellTiles[i] != Tile)
+		{
+			CellTiles[i] = Tile;
+			Changed.Add(i);
+		}
+	}
+	BlitCells(Changed);
+	UploadDirtyLayers();
+}
+
+void UYukiWaveFunctionCollapseMinimap::UpdateCells(const UYukiWaveFunctionCollapseSolver& Solver, TConstArrayView<int> Cells)
+{
+	check(CellTiles.Num() == Solver.NumCells());
+	for (const int Cell : Cells)
+	{
+		CellTiles[Cell] = Solver.GetCollapsedTileIndex(Cell);
+	}
+	BlitCells(Cells);
+	UploadDirtyLayers();
+}
+
+UTexture2D* UYukiWaveFunctionCollapseMinimap::GetLayerTexture(int32 Z) const
+{
+	return LayerTextures.IsValidIndex(Z) ? LayerTextures[Z] : nullptr;
+}
+
+void UYukiWaveFunctionCollapseMinimap::BlitCells(TConstArrayView<int> Cells)
+{
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_MinimapBlit);
+	if (Cells.Num() == 0)
+	{
+		return;
+	}
+	const int Width = GetLayerWidth();
+	const int CellsPerLayer = Size.X * Size.Y;
+	const FYukiWaveFunctionCollapseBrushAtlas& BrushAtlas = *Atlas;
+	// The layers were sized for the atlas, BrushSize may have been edited since.
+	const int CellPixels = BrushAtlas.BrushSize;
+
+	// Every cell owns its own block of pixels, so cells can be written from any thread.
+	auto BlitCell = [&](int Cell)
+	{
+		const int X = Cell % Size.X;
+		const int Y = (Cell / Size.X) % Size.Y;
+		const int Z = Cell / CellsPerLayer;
+		const int Tile = CellTiles[Cell];
+		const FColor* Brush = Tile != INDEX_NONE && BrushAtlas.HasBrush[Tile] ? BrushAtlas.GetBrush(Tile) : nullptr;
+		FColor* Dest = Layers[Z].GetData() + (Y * CellPixels) * Width + X * CellPixels;
+		for (int Row = 0; Row < CellPixels; Row++, Dest += Width)
+		{
+			if (Brush)
+			{
+				FMemory::Memcpy(Dest, Brush + Row * CellPixels, CellPixels * sizeof(FColor));
+			}
+			else
+			{
+				for (int Column = 0; Column < CellPixels; Column++)
+				{
+					Dest[Column] = BackgroundColor;
+				}
+			}
+		}
+	};
+
+	if (Cells.Num() == CellTiles.Num())
+	{
+		// Full redraw, one task per row of cells.
+		ParallelFor(Size.Y * Size.Z, [&](int32 CellRow)
+		{
+			const int First = CellRow * Size.X;
+			for (int Cell = First; Cell < First + Size.X; Cell++)
+			{
+				BlitCell(Cell);
+			}
+		});
+		DirtyLayers.Init(true, Size.Z);
+		return;
+	}
+	ParallelFor(Cells.Num(), [&](int32 i) { BlitCell(Cells[i]); }, Cells.Num() < YukiWaveFunctionCollapseMinimap::ParallelBlitThreshold);
+	for (const int Cell : Cells)
+	{
+		DirtyLayers[Cell / CellsPerLayer] = true;
+	}
+}
+
+void UYukiWaveFunctionCollapseMinimap::UploadDirtyLayers()
+{
+	const int Width = GetLayerWidth();
+	const int Height = GetLayerHeight();
+	for (TConstSetBitIterator<> It(DirtyLayers); It; ++It)
+	{
+		const int Z = It.GetIndex();
+		UTexture2D* Texture = LayerTextures[Z];
+		if (!Texture)
+		{
+			Texture = UTexture2D::CreateTransient(Width, Height, PF_B8G8R8A8, *FString::Printf(TEXT("%s_Layer%d"), *GetName(), Z));
+			if (!Texture)
+			{
+				UE_LOG(LogWFC, Error, TEXT("Could not create a %dx%d minimap texture."), Width, Height);
+				continue;
+			}
+			Texture->Filter = TF_Nearest;
+			Texture->SRGB = true;
+			LayerTextures[Z] = Texture;
+		}
+
+		FTexture2DMipMap& Mip = Texture->GetPlatformData()->Mips[0];
+		void* Data = Mip.BulkData.Lock(LOCK_READ_WRITE);
+		FMemory::Memcpy(Data, Layers[Z].GetData(), Layers[Z].Num() * sizeof(FColor));
+		Mip.BulkData.Unlock();
+		if (FApp::CanEverRender())
+		{
+			Texture->UpdateResource();
+		}
+	}
+	DirtyLayers.Init(false, DirtyLayers.Num());
+}
+
+TSharedPtr<const FYukiWaveFunctionCollapseBrushAtlas> UYukiWaveFunctionCollapseMinimap::GetAtlas(UYukiWaveFunctionCollapseModel& InModel, const TSharedRef<const FYukiWaveFunctionCollapseCompiledModel>& InRules, int InBrushSize)
+{
+	check(IsInGameThread());
+	const FYukiWaveFunctionCollapseCompiledModel& Rules = *InRules;
+	const TTuple<uint64, uint64, int> Key = MakeTuple(Rules.ContentHash, YukiWaveFunctionCollapseMinimap::ComputeBrushHash(InModel, Rules), InBrushSize);
+	if (const TSharedPtr<const FYukiWaveFunctionCollapseBrushAtlas>* Found = YukiWaveFunctionCollapseMinimap::AtlasCache.Find(Key))
+	{
+		return *Found;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_MinimapAtlas);
+	const TSharedPtr<FYukiWaveFunctionCollapseBrushAtlas> NewAtlas = MakeShared<FYukiWaveFunctionCollapseBrushAtlas>();
+	NewAtlas->BrushSize = InBrushSize;
+	NewAtlas->Pixels.SetNumZeroed(Rules.NumTiles() * InBrushSize * InBrushSize);
+	NewAtlas->HasBrush.Init(false, Rules.NumTiles());
+	for (int Tile = 0; Tile < Rules.NumTiles(); Tile++)
+	{
+		// Tiles removed from the model since the rules were compiled have no brush.
+		const FYukiWaveFunctionCollapseTileModel* TileModel = InModel.Tiles.Find(Rules.TileTags[Tile]);
+		UTexture2D* Texture = TileModel ? TileModel->BrushTexture.LoadSynchronous() : nullptr;
+		if (!Texture)
+		{
+			continue;
+		}
+		const int Quarters = YukiWaveFunctionCollapseMinimap::GetBrushQuarters(*TileModel);
+		FColor* Brush = NewAtlas->Pixels.GetData() + Tile * InBrushSize * InBrushSize;
+		if (ReadBrush(*Texture, InBrushSize, Quarters, Brush))
+		{
+			NewAtlas->HasBrush[Tile] = true;
+		}
+		else
+		{
+			UE_LOG(LogWFC, Warning, TEXT("Brush %s of tile %s has no CPU readable BGRA8 data, it will not show on the minimap."), *Texture->GetName(), *Rules.TileTags[Tile].ToString());
+		}
+	}
+	YukiWaveFunctionCollapseMinimap::AtlasCache.Add(Key, NewAtlas);
+	return NewAtlas;
+}
+
+void UYukiWaveFunctionCollapseMinimap::EmptyAtlasCache()
+{
+	check(IsInGameThread());
+	YukiWaveFunctionCollapseMinimap::AtlasCache.Empty();
+}
+
+bool UYukiWaveFunctionCollapseMinimap::ReadBrush(UTexture2D& Texture, int InBrushSize, int Quarters, FColor* OutPixels)
+{
+	TArray64<uint8> SourceData;
+	int SourceWidth = 0;
+	int SourceHeight = 0;
+
+#if WITH_EDITORONLY_DATA
+	// Source art is always available in the editor, regardless of the compression settings.
+	if (Texture.Source.IsValid() && Texture.Source.GetFormat() == TSF_BGRA8)
+	{
+		SourceWidth = Texture.Source.GetSizeX();
+		SourceHeight = Texture.Source.GetSizeY();
+		Texture.Source.GetMipData(SourceData, 0);
+	}
+#endif
+	// Cooked builds can only read uncompressed mips that are resident, e.g. UserInterface2D without compression.
+	const FTexturePlatformData* PlatformData = Texture.GetPlatformData();
+	if (SourceData.Num() == 0 && PlatformData && PlatformData->PixelFormat == PF_B8G8R8A8)
+	{
+		for (const FTexture2DMipMap& Mip : PlatformData->Mips)
+		{
+			if (Mip.BulkData.IsBulkDataLoaded() && Mip.BulkData.GetBulkDataSize() > 0)
+			{
+				SourceWidth = Mip.SizeX;
+				SourceHeight = Mip.SizeY;
+				SourceData.SetNumUninitialized(Mip.BulkData.GetBulkDataSize());
+				FMemory::Memcpy(SourceData.GetData(), Mip.BulkData.LockReadOnly(), SourceData.Num());
+				Mip.BulkData.Unlock();
+				break;
+			}
+		}
+	}
+	if (SourceData.Num() < (int64) SourceWidth * SourceHeight * (int64) sizeof(FColor) || SourceWidth == 0 || SourceHeight == 0)
+	{
+		return false;
+	}
+
+	// Nearest sampling, rotated clockwise around the brush center.
+	const FColor* Source = reinterpret_cast<const FColor*>(SourceData.GetData());
+	const int Last = InBrushSize - 1;
+	for (int Y = 0; Y < InBrushSize; Y++)
+	{
+		for (int X = 0; X < InBrushSize; X++)
+		{
+			int U = X;
+			int V = Y;
+			switch (Quarters)
+			{
+			case 1: U = Y; V = Last - X; break;
+			case 2: U = Last - X; V = Last - Y; break;
+			case 3: U = Last - Y; V = X; break;
+			default: break;
+			}
+			const int SourceX = U * SourceWidth / InBrushSize;
+			const int SourceY = V * SourceHeight / InBrushSize;
+			OutPixels[Y * InBrushSize + X] = Source[SourceY * SourceWidth + SourceX];
+		}
+	}
+	return true;
+}
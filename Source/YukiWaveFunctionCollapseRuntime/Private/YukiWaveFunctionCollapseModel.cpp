@@ -5,7 +5,6 @@
 #include "YukiWaveFunctionCollapseLog.h"
 #include "NativeGameplayTags.h"
 #include "ScopedTransaction.h"
-#include "Subsystems/EditorAssetSubsystem.h"
 #include "UObject/PropertyAccessUtil.h"
 
 #define LOCTEXT_NAMESPACE "YukiWaveFunctionCollapseModel"
@@ -13,74 +12,9 @@
 UE_DEFINE_GAMEPLAY_TAG(TAG_Border, "WFC.Constraints.Border")
 UE_DEFINE_GAMEPLAY_TAG(TAG_Empty, "WFC.Constraints.Empty")
 
-// Returns a Neighboring cell given an index and a direction. Will return false if the index is at a boundary of that direction.
 bool GetNeighborCell(FIntVector Size, int Index, EYDWaveFunctionDirection Direction, int& OutNeighborIndex)
 {
-	// The theory behind this math is that given an array of size N, a 3D array would be N*N*N.
-	// For example, a grid of 3 would be laid out in this order:
-	//0: [0, 1, 2], 1: [9,  10, 11], 2: [18, 19, 20]
-	//   [3, 4, 5],    [12, 13, 14],	[21, 22, 23]
-	//   [6, 7, 8]	   [15, 16, 17],	[24, 25, 26]
-
-	// For an odd lengthed vector of A*B*C elements, it can be visualized like:
-	// 0: [0, 1, 2, 3]    1: [12, 13, 14, 15],
-	//    [4, 5, 6, 7]       [16, 17, 18, 19],
-	//    [8, 9, 10, 11]     [20, 21, 22, 23]
-
-	// Index = X + (Y * #X) + (Z * #X * #Y)
-
-	int X = Index % Size.X;
-	int Y = (Index / Size.X) % Size.Y;
-	int Z = (Index / (Size.X * Size.Y) % Size.Z);
-
-	switch (Direction)
-	{
-		case EYDWaveFunctionDirection::XPlus:
-			if (X == Size.X - 1)
-			{
-				return false;
-			}
-			OutNeighborIndex = Index + 1;
-			break;
-		case EYDWaveFunctionDirection::XMinus:
-			if (X == 0)
-			{
-				return false;
-			}
-			OutNeighborIndex = Index - 1;
-			break;
-		case EYDWaveFunctionDirection::YPlus:
-			if (Y == Size.Y - 1)
-			{
-				return false;
-			}
-			OutNeighborIndex = Index + Size.X;
-			break;
-		case EYDWaveFunctionDirection::YMinus:
-			if (Y == 0)
-			{
-				return false;
-			}
-			OutNeighborIndex = Index - Size.X;
-			break;
-		case EYDWaveFunctionDirection::ZPlus:
-			if (Z == Size.Z - 1)
-			{
-				return false;
-			}
-			OutNeighborIndex = Index + (Size.X * Size.Y);
-			break;
-		case EYDWaveFunctionDirection::ZMinus:
-			if (Z == 0)
-			{
-				return false;
-			}
-			OutNeighborIndex = Index - (Size.X * Size.Y);
-			break;
-		default:
-			return false;
-	}
-	return true;
+	return YukiWaveFunctionCollapseTopology::GetNeighbor<FYukiWaveFunctionCollapseCubeTopology>(Size, Index, Direction, OutNeighborIndex);
 }
 
 EYDWaveFunctionDirection GetOppositeDirection(EYDWaveFunctionDirection Direction)
@@ -99,12 +33,97 @@ EYDWaveFunctionDirection GetOppositeDirection(EYDWaveFunctionDirection Direction
 			return EYDWaveFunctionDirection::ZMinus;
 		case EYDWaveFunctionDirection::ZMinus:
 			return EYDWaveFunctionDirection::ZPlus;
+		case EYDWaveFunctionDirection::HexNorthWest:
+			return EYDWaveFunctionDirection::HexSouthEast;
+		case EYDWaveFunctionDirection::HexSouthEast:
+			return EYDWaveFunctionDirection::HexNorthWest;
 		default:
 			checkNoEntry();
 			return EYDWaveFunctionDirection::MAX;
 	}
 }
 
+void UYukiWaveFunctionCollapseModel::PostLoad()
+{
+	Super::PostLoad();
+#if WITH_EDITOR
+	// Assets saved before the rules last changed shape, or by an older compiler, are rebuilt here.
+	if (CompiledModel.ContentHash != FYukiWaveFunctionCollapseCompiledModel::ComputeContentHash(*this))
+	{
+		CompileRules();
+		return;
+	}
+#else
+	if (!CompiledModel.IsCompiled())
+	{
+		UE_LOG(LogWFC, Warning, TEXT("%s was cooked without compiled rules, compiling at load."), *GetPathName());
+		CompileRules();
+		return;
+	}
+#endif
+	PublishCompiledModel();
+}
+
+#if WITH_EDITOR
+void UYukiWaveFunctionCollapseModel::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+	CompileRules();
+}
+
+void UYukiWaveFunctionCollapseModel::PostEditUndo()
+{
+	Super::PostEditUndo();
+	CompileRules();
+}
+#endif
+
+const FYukiWaveFunctionCollapseCompiledModel& UYukiWaveFunctionCollapseModel::GetCompiledModel()
+{
+	return *GetSharedCompiledModel();
+}
+
+TSharedRef<const FYukiWaveFunctionCollapseCompiledModel> UYukiWaveFunctionCollapseModel::GetSharedCompiledModel()
+{
+	check(IsInGameThread());
+	if (!PublishedModel.IsValid())
+	{
+		if (CompiledModel.IsCompiled())
+		{
+			PublishCompiledModel();
+		}
+		else
+		{
+			CompileRules();
+		}
+	}
+	return PublishedModel.ToSharedRef();
+}
+
+bool UYukiWaveFunctionCollapseModel::CompileRules()
+{
+	check(IsInGameThread());
+	const uint64 PreviousHash = PublishedModel.IsValid() ? PublishedModel->ContentHash : 0;
+	// Tables already published may be read by solvers on other threads, they are left untouched.
+	CompiledModel.Compile(*this);
+	PublishCompiledModel();
+	if (PublishedModel->ContentHash != PreviousHash)
+	{
+		OnRulesChanged.Broadcast(this);
+	}
+	return !PublishedModel->bHasContradictions;
+}
+
+void UYukiWaveFunctionCollapseModel::PublishCompiledModel()
+{
+#if WITH_EDITOR
+	PublishedModel = MakeShared<const FYukiWaveFunctionCollapseCompiledModel>(CompiledModel);
+#else
+	PublishedModel = MakeShared<const FYukiWaveFunctionCollapseCompiledModel>(MoveTemp(CompiledModel));
+	CompiledModel = FYukiWaveFunctionCollapseCompiledModel();
+#endif
+}
+
 #if WITH_EDITORONLY_DATA
 void UYukiWaveFunctionCollapseModel::SolveContradictions()
 {
@@ -134,7 +153,7 @@ void UYukiWaveFunctionCollapseModel::SolveContradictions()
 				FYukiWaveFunctionCollapseTileModel& NeighborData = Tiles[Neighbor];
 				if (!NeighborData.Options.Contains(OppositeDirection))
 				{
-					NeighborData.Options[OppositeDirection] = FGameplayTagContainer(Tag);
+					NeighborData.Options.Add(OppositeDirection, FGameplayTagContainer(Tag));
 				}
 				else if (!NeighborData.Options[OppositeDirection].HasTag(Tag))
 				{
@@ -145,8 +164,9 @@ void UYukiWaveFunctionCollapseModel::SolveContradictions()
 			Tiles[Tag].Options[Direction].RemoveTags(RemovalTags);
 		}
 	}
-	UEditorAssetSubsystem* AssetSubsystem = GEditor->GetEditorSubsystem<UEditorAssetSubsystem>();
-	AssetSubsystem->SaveAsset(GetPathName());
+	// Only the tiles whose rules were mirrored are recompiled, saving is left to the user.
+	MarkPackageDirty();
+	CompileRules();
 	FPropertyEditorModule& PropertyEditorModule = FModuleManager::GetModuleChecked<FPropertyEditorModule>("PropertyEditor");
 	PropertyEditorModule.NotifyCustomizationModuleChanged();
 }
@@ -156,44 +176,149 @@ UYukiWaveFunctionCollapseSolver::UYukiWaveFunctionCollapseSolver()
 	Random = FRandomStream(FPlatformTime::Cycles());
 }
 
+void UYukiWaveFunctionCollapseSolver::BeginDestroy()
+{
+	YUKI_WFC_SET_MEMORY(SolveStats, 0);
+	Super::BeginDestroy();
+}
+
 void UYukiWaveFunctionCollapseSolver::Init(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, FRandomStream InRandom)
 {
 	Model = InModel;
 	Size = InSize;
 	Random = InRandom;
+	Rules = Model->GetSharedCompiledModel();
+	InitialState.Reset();
+	FocusCosts.Reset();
 	UE_LOG(LogWFC, Log, TEXT("Init Solver with Size: %s and Seed: %d"), *Size.ToString(), InRandom.GetCurrentSeed());
-	Cells.Empty();
-	Cells.Reserve(Size.X * Size.Y * Size.Z);
+	YUKI_WFC_SET_MEMORY(SolveStats, 0);
+	SolveStats = FYukiWaveFunctionCollapseSolveStats();
+	InitCells();
+}
 
-	FGameplayTagContainer AllTags;
-	TArray<FGameplayTag> AllTagsArray;
-	Model->Tiles.GetKeys(AllTagsArray);
-	for (const auto& GameplayTag : AllTagsArray)
+void UYukiWaveFunctionCollapseSolver::Reset(int32 Seed)
+{
+	check(Model && Rules);
+	Random.Initialize(Seed);
+	UE_LOG(LogWFC, Verbose, TEXT("Reset Solver with Seed: %d"), Seed);
+	YUKI_WFC_SET_MEMORY(SolveStats, 0);
+	SolveStats = FYukiWaveFunctionCollapseSolveStats();
+	InitCells();
+}
+
+void UYukiWaveFunctionCollapseSolver::InitCells()
+{
+	YUKI_WFC_SCOPE(Init, SolveStats);
+	bAllDirty = true;
+	if (!InitialState.IsValid() || InitialStateHash != Rules->ContentHash || InitialStateSize != Size)
 	{
-		AllTags.AddTag(GameplayTag);
+		InitialStateHash = Rules->ContentHash;
+		InitialStateSize = Size;
+		FYukiWaveFunctionCollapseInitialStateCache& Cache = FYukiWaveFunctionCollapseInitialStateCache::Get();
+		InitialState = Cache.Find(Rules->ContentHash, Size);
+		if (!InitialState.IsValid())
+		{
+			BuildInitialState();
+			// Another solver may have built the same state meanwhile, keep a single copy.
+			InitialState = Cache.Add(Rules->ContentHash, Size, MakeInitialState());
+		}
 	}
 
-	for (int i = 0; i < Cells.Max(); i++)
+	Wave = InitialState->Wave;
+	CollapsedCells = InitialState->CollapsedCells;
+	NumCollapsedCells = InitialState->NumCollapsedCells;
+	bContradiction = InitialState->bContradiction;
+	ExhaustedMask.Init(0, Rules->NumWords);
+	for (int Tile = 0; Tile < Rules->NumTiles(); Tile++)
 	{
-		FYukiWaveFunctionCollapseCell Cell;
-		Cell.Options.AppendTags(AllTags);
-		Cells.Add(Cell);
+		UpdateExhausted(Tile);
 	}
-	for (int i = 0; i < Cells.Num(); i++)
+	DirtyCells.Reset();
+	DirtyMask.Init(false, Wave.Num());
+	bAllDirty = true;
+	InitRequirements();
+	UpdateMemoryStats();
+}
+
+void UYukiWaveFunctionCollapseSolver::InitConstrained(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, int32 Seed, uint32 BorderDirections, TConstArrayView<uint64> CellMasks, TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> InRules)
+{
+	Model = InModel;
+	Size = InSize;
+	Random.Initialize(Seed);
+	Rules = InRules.IsValid() ? MoveTemp(InRules) : TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel>(Model->GetSharedCompiledModel());
+	check(CellMasks.Num() == 0 || CellMasks.Num() == Size.X * Size.Y * Size.Z * Rules->NumWords);
+	YUKI_WFC_SET_MEMORY(SolveStats, 0);
+	SolveStats = FYukiWaveFunctionCollapseSolveStats();
+	{
+		YUKI_WFC_SCOPE(Init, SolveStats);
+		BuildInitialState(BorderDirections, CellMasks);
+	}
+	// Private to this solver, restarts and Reset return to it without going through the shared cache.
+	InitialState = MakeInitialState();
+	InitialStateHash = Rules->ContentHash;
+	InitialStateSize = Size;
+	InitCells();
+}
+
+TSharedRef<const FYukiWaveFunctionCollapseInitialState> UYukiWaveFunctionCollapseSolver::MakeInitialState() const
+{
+	TSharedRef<FYukiWaveFunctionCollapseInitialState> State = MakeShared<FYukiWaveFunctionCollapseInitialState>();
+	State->Wave = Wave;
+	State->CollapsedCells = CollapsedCells;
+	State->NumCollapsedCells = NumCollapsedCells;
+	State->bContradiction = bContradiction;
+	return State;
+}
+
+void UYukiWaveFunctionCollapseSolver::UpdateMemoryStats()
+{
+	YUKI_WFC_SET_MEMORY(SolveStats, Wave.GetAllocatedSize() + CollapsedCells.GetAllocatedSize() + Worklist.GetAllocatedSize() + InWorklist.GetAllocatedSize() + DirtyMask.GetAllocatedSize() + DirtyCells.GetAllocatedSize());
+}
+
+void UYukiWaveFunctionCollapseSolver::BuildInitialState(uint32 BorderDirections, TConstArrayView<uint64> CellMasks)
+{
+	const int NumTiles = Rules->NumTiles();
+	Wave.Init(Size.X * Size.Y * Size.Z, Rules->NumWords, Rules->AllMask.GetData(), NumTiles);
+	CollapsedCells.Init(Wave.Num(), NumTiles);
+	ExhaustedMask.Init(0, Rules->NumWords);
+	NumCollapsedCells = NumTiles == 1 ? Wave.Num() : 0;
+	if (NumTiles == 1)
 	{
-		FYukiWaveFunctionCollapseCell& Cell = Cells[i];
-		TArray<EYDWaveFunctionDirection> ValidDirections = ValidBorders(i);
-		if (ValidDirections.Num() > 0)
+		for (int i = 0; i < Wave.Num(); i++)
 		{
-			for (const auto& Border : ValidBorders(i))
+			CollapsedCells.Add(i, 0);
+		}
+		UpdateExhausted(0);
+	}
+	bContradiction = false;
+
+	// Every border and cell mask is applied first and propagated once from all changed cells, instead of a
+	// propagation per border cell that revisits the interior again and again.
+	TArray<int> Changed;
+	for (int i = 0; i < Wave.Num(); i++)
+	{
+		int NumRemoved = 0;
+		for (const auto& Border : ValidBorders(i))
+		{
+			if (Rules->HasBorder(Border) && (BorderDirections & (1u << (uint32) Border)))
 			{
-				if (Model->Borders.Contains(Border) && Model->Borders[Border].Num() > 0)
-				{
-					Cell.Options = Cell.Options.Filter(Model->Borders[Border]);
-					PropagateFrom(i);
-				}
+				NumRemoved += ConstrainCell(i, Rules->GetBorderMask(Border));
 			}
 		}
+		if (CellMasks.Num() > 0)
+		{
+			NumRemoved += ConstrainCell(i, CellMasks.GetData() + i * Rules->NumWords);
+		}
+		if (NumRemoved > 0)
+		{
+			// Cells without neighbors would not notice running out of options while propagating.
+			bContradiction |= Wave.GetCount(i) == 0;
+			Changed.Add(i);
+		}
+	}
+	if (!bContradiction && Changed.Num() > 0)
+	{
+		Propagate(Changed, FIntVector::ZeroValue, Size);
 	}
 }
 void UYukiWaveFunctionCollapseSolver::CheckContradictions()
@@ -222,42 +347,120 @@ void UYukiWaveFunctionCollapseSolver::CheckContradictions()
 }
 void UYukiWaveFunctionCollapseSolver::SolveFully()
 {
-	CheckContradictions();
+	// The model is validated when its rules are compiled, only report the details when that failed.
+	if (Rules->bHasContradictions)
+	{
+		CheckContradictions();
+	}
 
 	// Edge case, solved even before single iteration. Probably not possible, may be is.
 	if (IsSolved())
 	{
 		return;
 	}
+	if (InitialState->bContradiction)
+	{
+		UE_LOG(LogWFC, Error, TEXT("The borders of %s cannot be satisfied at size %s."), *Model->GetPathName(), *Size.ToString());
+		return;
+	}
+	bRejected = false;
 
 	int NumIterations = 0;
+	int NumRestarts = 0;
 	const int MaxIterations = Size.X * Size.Y * Size.Z;
 	do
 	{
-		if (NumIterations > MaxIterations)
+		if (bContradiction || NumIterations > MaxIterations)
 		{
-			Random = FRandomStream(FPlatformTime::Cycles());
-			Init(Model, Size, Random);
+			if (MaxRestarts != -1 && NumRestarts++ >= MaxRestarts)
+			{
+				UE_LOG(LogWFC, Verbose, TEXT("Giving up after %d restarts."), MaxRestarts);
+				break;
+			}
+			// Partially constrained cells grow the wave while solving, record it before it is reset.
+			UpdateMemoryStats();
+			// Derive the next seed from the current stream so seeded solves stay reproducible.
+			Random = FRandomStream((int32) Random.GetUnsignedInt());
+			UE_LOG(LogWFC, Log, TEXT("Restarting solve with Seed: %d"), Random.GetCurrentSeed());
+			YUKI_WFC_INC(Restarts, SolveStats, 1);
+			InitCells();
 			NumIterations = 0;
 		}
+		// Checked before the first iteration of every attempt too, the initial state may already miss a
+		// requirement. A contradicted attempt has cells without options and is restarted instead of rejected.
+		if (!bContradiction && !CanMeetRequirements())
+		{
+			UE_LOG(LogWFC, Verbose, TEXT("Rejected solve after %d iterations, a requirement can no longer be met."), NumIterations);
+			bRejected = true;
+			break;
+		}
 		SingleIteration();
 		++NumIterations;
 	}
 	while (!IsSolved());
+	// The iteration that solved the grid is not checked in the loop, its counts are final.
+	if (IsSolved() && !CanMeetRequirements())
+	{
+		UE_LOG(LogWFC, Verbose, TEXT("Rejected solve after %d iterations, a requirement is not met."), NumIterations);
+		bRejected = true;
+	}
+	UpdateMemoryStats();
 }
 void UYukiWaveFunctionCollapseSolver::SingleIteration()
 {
-	const int Index = GetMinimumEntropyCellIndex();
+	YUKI_WFC_INC(Iterations, SolveStats, 1);
+	int Index;
+	{
+		YUKI_WFC_SCOPE(Select, SolveStats);
+		Index = GetMinimumEntropyCellIndex();
+	}
+	if (Index == INDEX_NONE)
+	{
+		return;
+	}
 	CollapseAt(Index);
-	PropagateFrom(Index);
+	if (!bContradiction)
+	{
+		PropagateFrom(Index);
+	}
+}
+
+TArray<FYukiWaveFunctionCollapseCell> UYukiWaveFunctionCollapseSolver::GetCells() const
+{
+	TArray<FYukiWaveFunctionCollapseCell> OutCells;
+	OutCells.SetNum(Wave.Num());
+	for (int i = 0; i < Wave.Num(); i++)
+	{
+		OutCells[i].Options = GetTagsForIndex(i);
+	}
+	return OutCells;
+}
+
+TArray<FGameplayTag> UYukiWaveFunctionCollapseSolver::GetCollapsedTags() const
+{
+	TArray<FGameplayTag> OutTags;
+	OutTags.SetNum(Wave.Num());
+	for (int i = 0; i < Wave.Num(); i++)
+	{
+		OutTags[i] = GetCollapsedTag(i);
+	}
+	return OutTags;
 }
 
 TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByTag(const FGameplayTag& Tag) const
 {
+	TArray<uint64, TInlineAllocator<4>> Mask;
+	Mask.SetNumUninitialized(Rules->NumWords);
+	Rules->GetMatchingMask(Tag, Mask.GetData());
+	if (IsSolved())
+	{
+		return GetCollapsedCellsByMask(Mask.GetData());
+	}
+
 	TArray<int> OutCells;
-	for (int i = 0; i < Cells.Num(); i++)
+	for (int i = 0; i < Wave.Num(); i++)
 	{
-		if (Cells[i].Options.HasTag(Tag))
+		if (Wave.HasAny(i, Mask.GetData()))
 		{
 			OutCells.Add(i);
 		}
@@ -267,10 +470,27 @@ TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByTag(const FGameplayTag& T
 
 TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByAnyTags(const FGameplayTagContainer& Tags) const
 {
+	TArray<uint64, TInlineAllocator<4>> Mask;
+	Mask.Init(0, Rules->NumWords);
+	TArray<uint64, TInlineAllocator<4>> TagMask;
+	TagMask.SetNumUninitialized(Rules->NumWords);
+	for (const FGameplayTag& Tag : Tags)
+	{
+		Rules->GetMatchingMask(Tag, TagMask.GetData());
+		for (int Word = 0; Word < Rules->NumWords; Word++)
+		{
+			Mask[Word] |= TagMask[Word];
+		}
+	}
+	if (IsSolved())
+	{
+		return GetCollapsedCellsByMask(Mask.GetData());
+	}
+
 	TArray<int> OutCells;
-	for (int i = 0; i < Cells.Num(); i++)
+	for (int i = 0; i < Wave.Num(); i++)
 	{
-		if (Cells[i].Options.HasAny(Tags))
+		if (Wave.HasAny(i, Mask.GetData()))
 		{
 			OutCells.Add(i);
 		}
@@ -280,10 +500,40 @@ TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByAnyTags(const FGameplayTa
 
 TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByAllTags(const FGameplayTagContainer& Tags) const
 {
+	const int NumWords = Rules->NumWords;
+	TArray<uint64, TInlineAllocator<16>> Masks;
+	Masks.SetNumUninitialized(Tags.Num() * NumWords);
+	for (int TagIndex = 0; TagIndex < Tags.Num(); TagIndex++)
+	{
+		Rules->GetMatchingMask(Tags.GetByIndex(TagIndex), Masks.GetData() + TagIndex * NumWords);
+	}
+	if (IsSolved())
+	{
+		// A collapsed cell has one tile, so it has all tags only if that tile matches every tag.
+		TArray<uint64, TInlineAllocator<4>> Mask;
+		Mask.Init(Tags.Num() > 0 ? ~0ull : 0ull, NumWords);
+		for (int TagIndex = 0; TagIndex < Tags.Num(); TagIndex++)
+		{
+			for (int Word = 0; Word < NumWords; Word++)
+			{
+				Mask[Word] &= Masks[TagIndex * NumWords + Word];
+			}
+		}
+		if (Tags.Num() > 0)
+		{
+			return GetCollapsedCellsByMask(Mask.GetData());
+		}
+	}
+
 	TArray<int> OutCells;
-	for (int i = 0; i < Cells.Num(); i++)
+	for (int i = 0; i < Wave.Num(); i++)
 	{
-		if (Cells[i].Options.HasAll(Tags))
+		bool bHasAll = true;
+		for (int TagIndex = 0; TagIndex < Tags.Num() && bHasAll; TagIndex++)
+		{
+			bHasAll = Wave.HasAny(i, Masks.GetData() + TagIndex * NumWords);
+		}
+		if (bHasAll)
 		{
 			OutCells.Add(i);
 		}
@@ -293,198 +543,771 @@ TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByAllTags(const FGameplayTa
 
 bool UYukiWaveFunctionCollapseSolver::IsSolved() const
 {
-	for (const auto& It : Cells)
+	return NumCollapsedCells == Wave.Num();
+}
+int UYukiWaveFunctionCollapseSolver::GetMinimumEntropyCellIndex() const
+{
+	if (FocusCosts.Num() == Wave.Num())
 	{
-		if (It.Options.Num() == 0 || It.Options.Num() > 1)
+		// Ties go to the lowest index, the seed still varies which tiles are picked.
+		float MinCost = MAX_flt;
+		int Selected = INDEX_NONE;
+		for (int i = 0; i < Wave.Num(); i++)
 		{
-			return false;
+			const int Entropy = Wave.GetCount(i);
+			if (Entropy == 1)
+			{
+				continue;
+			}
+			const float Cost = Entropy + FocusCosts[i];
+			if (Cost < MinCost)
+			{
+				MinCost = Cost;
+				Selected = i;
+			}
 		}
+		return Selected;
 	}
-	return true;
-}
-int UYukiWaveFunctionCollapseSolver::GetMinimumEntropyCellIndex() const
-{
-	TArray<TTuple<int, int>> EntropyList;
-	for (int i = 0; i < Cells.Num(); i++)
+
+	// Return a random value between the range of least entropious, sampled in a single pass.
+	int MinEntropy = MAX_int32;
+	int NumCandidates = 0;
+	int Selected = INDEX_NONE;
+	for (int i = 0; i < Wave.Num(); i++)
 	{
-		if (Cells[i].Options.Num() != 1)
+		const int Entropy = Wave.GetCount(i);
+		if (Entropy == 1 || Entropy > MinEntropy)
+		{
+			continue;
+		}
+		if (Entropy < MinEntropy)
 		{
-			EntropyList.Add(TTuple<int, int>(i, Cells[i].Options.Num()));
+			MinEntropy = Entropy;
+			NumCandidates = 0;
 		}
+		if (Random.RandRange(0, NumCandidates++) == 0)
+		{
+			Selected = i;
+		}
+	}
+	return Selected;
+}
+
+void UYukiWaveFunctionCollapseSolver::SetFocus(int32 Cell, float Bias)
+{
+	FocusCosts.Reset();
+	if (!Rules || Cell < 0 || Cell >= Wave.Num())
+	{
+		return;
+	}
+	FocusCosts.SetNumUninitialized(Wave.Num());
+	for (int i = 0; i < Wave.Num(); i++)
+	{
+		FocusCosts[i] = Bias * GetCellOffset(Rules->Topology, Size, Cell, i).Size();
 	}
-	EntropyList.Sort([](const TTuple<int, int>& A, const TTuple<int, int>& B) { return A.Get<1>() < B.Get<1>(); });
-	// Return a random value between the range of least entropious.
-	const int MinEntropy = EntropyList[0].Get<1>();
-	TArray<TTuple<int, int>> FilteredList = EntropyList.FilterByPredicate([MinEntropy](const TTuple<int, int>& A) { return A.Get<1>() == MinEntropy; });
-	const int RandomIndex = Random.RandRange(0, FilteredList.Num() - 1);
-	return FilteredList[RandomIndex].Get<0>();
 }
 
 void UYukiWaveFunctionCollapseSolver::CollapseAt(int Index)
 {
-	FGameplayTag SelectedTag = SelectTag(Index);
-	Cells[Index].Options.Reset();
-	Cells[Index].Options.AddTag(SelectedTag);
+	YUKI_WFC_SCOPE(Collapse, SolveStats);
+	const int Tile = SelectTile(Index);
+	if (Tile == INDEX_NONE)
+	{
+		YUKI_WFC_INC(Contradictions, SolveStats, 1);
+		bContradiction = true;
+		return;
+	}
+	YUKI_WFC_INC(Collapses, SolveStats, 1);
+	CollapseTo(Index, Tile);
+}
+
+void UYukiWaveFunctionCollapseSolver::CollapseTo(int Index, int Tile)
+{
+	const int PrevCount = Wave.GetCount(Index);
+	const int PrevTile = PrevCount == 1 ? Wave.GetFirstTile(Index) : INDEX_NONE;
+	if (bRecordTrail)
+	{
+		RecordTrail(Index);
+	}
+	Wave.Collapse(Index, Tile);
+	OnCellChanged(Index, PrevCount, PrevTile);
 }
 
-FGameplayTag UYukiWaveFunctionCollapseSolver::SelectTag(int Index) const
+void UYukiWaveFunctionCollapseSolver::SetCellMask(int Index, const uint64* Mask)
 {
-	if (Cells[Index].Options.Num() == 0)
+	const int PrevCount = Wave.GetCount(Index);
+	const int PrevTile = PrevCount == 1 ? Wave.GetFirstTile(Index) : INDEX_NONE;
+	int Count = 0;
+	for (int Word = 0; Word < Rules->NumWords; Word++)
+	{
+		Count += (int) FMath::CountBits(Mask[Word]);
+	}
+	if (bRecordTrail)
+	{
+		RecordTrail(Index);
+	}
+	Wave.SetMask(Index, Mask, Count);
+	OnCellChanged(Index, PrevCount, PrevTile);
+}
+
+int UYukiWaveFunctionCollapseSolver::SelectTile(int Index) const
+{
+	if (Wave.GetCount(Index) == 0)
 	{
 		UE_LOG(LogWFC, Warning, TEXT("SelectTag called on a cell (%d) with no options."), Index)
-		return FGameplayTag();
+		return INDEX_NONE;
 	}
 	// If the cell has a tag with a weight of 0.0, we will collapse that one specifically.
-	for (const auto& It : Cells[Index].Options)
+	int ZeroWeightTile = INDEX_NONE;
+	float MinWeight = MAX_flt;
+	float MaxWeight = -MAX_flt;
+	Wave.ForEachTile(Index, [&](int Tile)
 	{
-		if (Model->Tiles[It].Weight == 0.0f)
+		const float Weight = Rules->Weights[Tile];
+		if (Weight == 0.0f && ZeroWeightTile == INDEX_NONE)
 		{
-			return It;
+			ZeroWeightTile = Tile;
 		}
+		MinWeight = FMath::Min(MinWeight, Weight);
+		MaxWeight = FMath::Max(MaxWeight, Weight);
+	});
+	if (ZeroWeightTile != INDEX_NONE)
+	{
+		return ZeroWeightTile;
 	}
 
-	// Normalize the weights across all cells.
-	float TotalWeight = 0.0f;
-	TArray<TTuple<FGameplayTag, float>> WeightedOptions;
-	for (const auto& It : Cells[Index].Options)
+	// Select a value between min and max. Normalizing the weights does not change which ones clear it.
+	const float RandomWeight = Random.FRandRange(MinWeight, MaxWeight);
+	// Find all that clear the threshold, select a random one from them.
+	int NumCandidates = 0;
+	Wave.ForEachTile(Index, [&](int Tile)
 	{
-		TotalWeight += Model->Tiles[It].Weight;
-	}
-	for (const auto& It : Cells[Index].Options)
+		NumCandidates += Rules->Weights[Tile] >= RandomWeight ? 1 : 0;
+	});
+	int RandomIndex = Random.RandRange(0, FMath::Max(NumCandidates - 1, 0));
+	int Selected = INDEX_NONE;
+	Wave.ForEachTile(Index, [&](int Tile)
 	{
-		WeightedOptions.Add(TTuple<FGameplayTag, float>(It, Model->Tiles[It].Weight / TotalWeight));
+		if (Selected == INDEX_NONE && Rules->Weights[Tile] >= RandomWeight && RandomIndex-- == 0)
+		{
+			Selected = Tile;
+		}
+	});
+	if (Selected == INDEX_NONE)
+	{
+		// Float rounding left nothing above the threshold, fall back to the heaviest option.
+		Wave.ForEachTile(Index, [&](int Tile)
+		{
+			if (Selected == INDEX_NONE && Rules->Weights[Tile] == MaxWeight)
+			{
+				Selected = Tile;
+			}
+		});
 	}
-	// Sort the weighted options.
-	WeightedOptions.Sort([](const TTuple<FGameplayTag, float>& A, const TTuple<FGameplayTag, float>& B) { return A.Get<1>() < B.Get<1>(); });
-	// Get the maximum weight.
-	const float MaxWeight = WeightedOptions.Last().Get<1>();
-	// Select a value between min and max.
-	const float RandomWeight = Random.FRandRange(WeightedOptions[0].Get<1>(), MaxWeight);
-	// Find all that clear the threshold, select a random one from them.
-	TArray<TTuple<FGameplayTag, float>> FilteredList = WeightedOptions.FilterByPredicate([RandomWeight](const TTuple<FGameplayTag, float>& A) { return A.Get<1>() >= RandomWeight; });
-	const int RandomIndex = Random.RandRange(0, FilteredList.Num() - 1);
-	UE_LOG(LogWFC, Log, TEXT("For cell %d, From Tags %s Selecting tag %s"), Index, *Cells[Index].Options.ToString(), *FilteredList[RandomIndex].Get<0>().ToString(), FilteredList[RandomIndex].Get<1>());
-	return FilteredList[RandomIndex].Get<0>();
+	UE_LOG(LogWFC, Verbose, TEXT("For cell %d, Selecting tag %s"), Index, *Rules->TileTags[Selected].ToString());
+	return Selected;
 }
 
 void UYukiWaveFunctionCollapseSolver::PropagateFrom(int Index)
 {
-	TArray<int> Stack;
-	Stack.Push(Index);
+	Propagate(MakeArrayView(&Index, 1), FIntVector::ZeroValue, Size);
+}
 
-	while (Stack.Num() > 0)
+void UYukiWaveFunctionCollapseSolver::Propagate(TConstArrayView<int> Sources, const FIntVector& RegionMin, const FIntVector& RegionMax)
+{
+	YUKI_WFC_SCOPE(Propagate, SolveStats);
+	VisitTopology(Rules->Topology, [&](auto Topology)
+	{
+		Propagate<decltype(Topology)>(Sources, RegionMin, RegionMax);
+	});
+}
+
+template <typename TopologyType>
+void UYukiWaveFunctionCollapseSolver::Propagate(TConstArrayView<int> Sources, const FIntVector& RegionMin, const FIntVector& RegionMax)
+{
+	const int NumWords = Rules->NumWords;
+	TArray<uint64, TInlineAllocator<4>> ValidNeighbors;
+	ValidNeighbors.SetNumUninitialized(NumWords);
+	const bool bClipToRegion = RegionMin != FIntVector::ZeroValue || RegionMax != Size;
+
+	if (InWorklist.Num() != Wave.Num())
 	{
-		int NextIndex = Stack.Pop();
-		for (const auto& It : ValidDirections(NextIndex))
+		InWorklist.Init(false, Wave.Num());
+	}
+	Worklist.Reset();
+	for (const int Index : Sources)
+	{
+		if (!InWorklist[Index])
 		{
-			EYDWaveFunctionDirection Direction = It.Get<0>();
-			int NeighborIndex = It.Get<1>();
+			InWorklist[Index] = true;
+			Worklist.Push(Index);
+		}
+	}
 
-			ensureMsgf((NeighborIndex > -1 && NeighborIndex < Cells.Num()), TEXT("NeighborIndex is out of range: %d"), NeighborIndex);
+	// Counted locally and added to the stats once, the stat macros are too slow for the inner loop.
+	int NumPops = 0;
+	int NumEliminations = 0;
+	while (Worklist.Num() > 0 && !bContradiction)
+	{
+		const int NextIndex = Worklist.Pop();
+		InWorklist[NextIndex] = false;
+		NumPops++;
+		TopologyType::ForEachNeighbor(Size, NextIndex, [&](EYDWaveFunctionDirection Direction, int NeighborIndex)
+		{
+			if (bContradiction)
+			{
+				return;
+			}
+			if (bClipToRegion && !IsCellInRegion(NeighborIndex, RegionMin, RegionMax))
+			{
+				return;
+			}
 
-			FGameplayTagContainer ValidNeighbors = GetValidNeighbors(NextIndex, Direction);
-			FGameplayTagContainer& Neighbors = Cells[NeighborIndex].Options;
-			int PrevNumNeighbors = Neighbors.Num();
-			Neighbors = Neighbors.FilterExact(ValidNeighbors);
-			int CurrNumNeighbors = Neighbors.Num();
-			if (CurrNumNeighbors != PrevNumNeighbors)
+			GetAllowedNeighbors(NextIndex, Direction, ValidNeighbors.GetData());
+			// Remove neighbors that are past the count, unless the neighbor already is one of them.
+			if (Wave.GetCount(NeighborIndex) != 1)
 			{
-				if (!Stack.Contains(NeighborIndex))
+				for (int Word = 0; Word < NumWords; Word++)
 				{
-					Stack.Push(NeighborIndex);
+					ValidNeighbors[Word] &= ~ExhaustedMask[Word];
 				}
 			}
+
+			const int Removed = ConstrainCell(NeighborIndex, ValidNeighbors.GetData());
+			if (Removed > 0)
+			{
+				NumEliminations += Removed;
+				if (Wave.GetCount(NeighborIndex) == 0)
+				{
+					YUKI_WFC_INC(Contradictions, SolveStats, 1);
+					bContradiction = true;
+					return;
+				}
+				if (!InWorklist[NeighborIndex])
+				{
+					InWorklist[NeighborIndex] = true;
+					Worklist.Push(NeighborIndex);
+					YUKI_WFC_PEAK(PeakWorklistSize, SolveStats, Worklist.Num());
+				}
+			}
+		});
+	}
+	YUKI_WFC_INC(PropagationPops, SolveStats, NumPops);
+	YUKI_WFC_INC(Eliminations, SolveStats, NumEliminations);
+	// A contradiction stops early, leave the worklist clean for the next call.
+	for (const int Remaining : Worklist)
+	{
+		InWorklist[Remaining] = false;
+	}
+	Worklist.Reset();
+}
+
+void UYukiWaveFunctionCollapseSolver::GetAllowedNeighbors(int Index, EYDWaveFunctionDirection Direction, uint64* OutMask) const
+{
+	// Union of everything the options of this cell allow in that direction.
+	const int NumWords = Rules->NumWords;
+	FMemory::Memzero(OutMask, NumWords * sizeof(uint64));
+	Wave.ForEachTile(Index, [&](int Tile)
+	{
+		const uint64* Row = Rules->GetPropagatorRow(Direction, Tile);
+		for (int Word = 0; Word < NumWords; Word++)
+		{
+			OutMask[Word] |= Row[Word];
 		}
+	});
+}
+
+bool UYukiWaveFunctionCollapseSolver::IsCellInRegion(int Index, const FIntVector& Min, const FIntVector& Max) const
+{
+	const int X = Index % Size.X;
+	const int Y = (Index / Size.X) % Size.Y;
+	const int Z = Index / (Size.X * Size.Y);
+	return X >= Min.X && X < Max.X && Y >= Min.Y && Y < Max.Y && Z >= Min.Z && Z < Max.Z;
+}
+
+int UYukiWaveFunctionCollapseSolver::ConstrainCell(int Index, const uint64* Mask)
+{
+	const int PrevCount = Wave.GetCount(Index);
+	const int PrevTile = PrevCount == 1 ? Wave.GetFirstTile(Index) : INDEX_NONE;
+	if (bRecordTrail)
+	{
+		RecordTrail(Index);
 	}
+	const int Removed = Wave.Intersect(Index, Mask);
+	if (Removed > 0)
+	{
+		OnCellChanged(Index, PrevCount, PrevTile);
+	}
+	else if (bRecordTrail)
+	{
+		TrailCells.Pop(false);
+		TrailMasks.SetNum(TrailMasks.Num() - Rules->NumWords, false);
+	}
+	return Removed;
 }
-TArray<TTuple<EYDWaveFunctionDirection, int>> UYukiWaveFunctionCollapseSolver::ValidDirections(int Index) const
+
+void UYukiWaveFunctionCollapseSolver::OnCellChanged(int Index, int PrevCount, int PrevTile)
 {
-	// Return all valid directions from the given Index.
-	TArray<TTuple<EYDWaveFunctionDirection, int>> ValidDirections;
-	for (int i = 0; i < (int) EYDWaveFunctionDirection::MAX; i++)
+	if (!bAllDirty && !DirtyMask[Index])
 	{
-		int NeighborIndex;
-		if (GetNeighborCell(Size, Index, (EYDWaveFunctionDirection) i, NeighborIndex))
+		DirtyMask[Index] = true;
+		DirtyCells.Add(Index);
+	}
+	if (PrevCount == 1)
+	{
+		CollapsedCells.Remove(Index, PrevTile);
+		NumCollapsedCells--;
+		UpdateExhausted(PrevTile);
+	}
+	if (Wave.GetCount(Index) == 1)
+	{
+		const int Tile = Wave.GetFirstTile(Index);
+		CollapsedCells.Add(Index, Tile);
+		NumCollapsedCells++;
+		UpdateExhausted(Tile);
+	}
+	for (FRequirement& Requirement : Requirements)
+	{
+		// Sized by InitRequirements, the initial state is built before that.
+		if (Requirement.Possible.Num() != Wave.Num())
+		{
+			continue;
+		}
+		const bool bPossible = Wave.HasAny(Index, Requirement.Mask.GetData());
+		if (bPossible != Requirement.Possible[Index])
 		{
-			ValidDirections.Add(TTuple<EYDWaveFunctionDirection, int>((EYDWaveFunctionDirection) i, NeighborIndex));
+			Requirement.Possible[Index] = bPossible;
+			Requirement.NumPossible += bPossible ? 1 : -1;
 		}
 	}
-	return ValidDirections;
 }
 
-FGameplayTagContainer UYukiWaveFunctionCollapseSolver::GetTagsForIndex(int Index) const
+void UYukiWaveFunctionCollapseSolver::SetRequirements(const TMap<FGameplayTag, int32>& MinCounts)
 {
-	FGameplayTagContainer OptionsCopy = Cells[Index].Options;
-	return OptionsCopy;
+	Requirements.Reset();
+	for (const TPair<FGameplayTag, int32>& MinCount : MinCounts)
+	{
+		FRequirement& Requirement = Requirements.AddDefaulted_GetRef();
+		Requirement.Tag = MinCount.Key;
+		Requirement.MinCount = MinCount.Value;
+	}
+	if (Rules && Wave.Num() > 0)
+	{
+		InitRequirements();
+	}
 }
 
-void UYukiWaveFunctionCollapseSolver::RemoveTagsFromUncollapsed(const FGameplayTagContainer& Tags)
+void UYukiWaveFunctionCollapseSolver::InitRequirements()
 {
-	for (int i = 0; i < Cells.Num(); i++)
+	bRejected = false;
+	for (FRequirement& Requirement : Requirements)
 	{
-		if (Cells[i].Options.Num() > 1 && Cells[i].Options.HasAny(Tags))
+		Requirement.Mask.SetNumUninitialized(Rules->NumWords);
+		Rules->GetMatchingMask(Requirement.Tag, Requirement.Mask.GetData());
+		Requirement.Possible.Init(false, Wave.Num());
+		Requirement.NumPossible = 0;
+		for (int i = 0; i < Wave.Num(); i++)
 		{
-			Cells[i].Options.RemoveTags(Tags);
-			PropagateFrom(i);
+			if (Wave.HasAny(i, Requirement.Mask.GetData()))
+			{
+				Requirement.Possible[i] = true;
+				Requirement.NumPossible++;
+			}
+		}
+	}
+}
+
+bool UYukiWaveFunctionCollapseSolver::CanMeetRequirements() const
+{
+	for (const FRequirement& Requirement : Requirements)
+	{
+		if (Requirement.NumPossible < Requirement.MinCount)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void UYukiWaveFunctionCollapseSolver::UpdateExhausted(int Tile)
+{
+	const int MaxCount = Rules->MaxCounts[Tile];
+	const uint64 Bit = 1ull << (Tile % 64);
+	if (MaxCount != -1 && CollapsedCells.Num(Tile) >= MaxCount)
+	{
+		ExhaustedMask[Tile / 64] |= Bit;
+	}
+	else
+	{
+		ExhaustedMask[Tile / 64] &= ~Bit;
+	}
+}
+
+bool UYukiWaveFunctionCollapseSolver::ResolveRegion(FIntVector Min, FIntVector Max, int32 Seed, int32 MaxBacktracks)
+{
+	check(Rules);
+	Min = FIntVector(FMath::Max(Min.X, 0), FMath::Max(Min.Y, 0), FMath::Max(Min.Z, 0));
+	Max = FIntVector(FMath::Min(Max.X, Size.X), FMath::Min(Max.Y, Size.Y), FMath::Min(Max.Z, Size.Z));
+	if (Min.X >= Max.X || Min.Y >= Max.Y || Min.Z >= Max.Z)
+	{
+		return true;
+	}
+	UE_LOG(LogWFC, Log, TEXT("Resolving region %s - %s with Seed: %d"), *Min.ToString(), *Max.ToString(), Seed);
+	Random.Initialize(Seed);
+	bContradiction = false;
+
+	const int NumWords = Rules->NumWords;
+	TArray<int> RegionCells;
+	RegionCells.Reserve((Max.X - Min.X) * (Max.Y - Min.Y) * (Max.Z - Min.Z));
+	for (int Z = Min.Z; Z < Max.Z; Z++)
+	{
+		for (int Y = Min.Y; Y < Max.Y; Y++)
+		{
+			for (int X = Min.X; X < Max.X; X++)
+			{
+				RegionCells.Add(X + (Y * Size.X) + (Z * Size.X * Size.Y));
+			}
+		}
+	}
+	// Every change from here on is recorded, unwinding the whole trail leaves the region as it was.
+	TGuardValue<bool> RecordGuard(bRecordTrail, true);
+	TrailCells.Reset();
+	TrailMasks.Reset();
+
+	// Back to full superposition, keeping the grid borders.
+	for (const int Cell : RegionCells)
+	{
+		SetCellMask(Cell, Rules->AllMask.GetData());
+		for (const EYDWaveFunctionDirection Border : ValidBorders(Cell))
+		{
+			if (Rules->HasBorder(Border))
+			{
+				ConstrainCell(Cell, Rules->GetBorderMask(Border));
+			}
+		}
+	}
+	// Constrain the region by the cells around it.
+	TArray<uint64, TInlineAllocator<4>> Allowed;
+	Allowed.SetNumUninitialized(NumWords);
+	for (const int Cell : RegionCells)
+	{
+		for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Rules->Topology))
+		{
+			int NeighborIndex;
+			if (GetNeighborCell(Rules->Topology, Size, Cell, Direction, NeighborIndex) && !IsCellInRegion(NeighborIndex, Min, Max))
+			{
+				GetAllowedNeighbors(NeighborIndex, GetOppositeDirection(Direction), Allowed.GetData());
+				ConstrainCell(Cell, Allowed.GetData());
+			}
+		}
+		if (Wave.GetCount(Cell) == 0)
+		{
+			bContradiction = true;
+		}
+	}
+	if (!bContradiction)
+	{
+		Propagate(RegionCells, Min, Max);
+	}
+
+	// Every decision remembers where the trail stood before it was made, a contradiction only rewinds the
+	// cells changed since.
+	struct FDecision
+	{
+		int Cell;
+		int Tile;
+		int TrailStart;
+	};
+	TArray<FDecision> Decisions;
+	int NumBacktracks = 0;
+	while (true)
+	{
+		if (bContradiction)
+		{
+			bool bRecovered = false;
+			while (!bRecovered && Decisions.Num() > 0 && NumBacktracks < MaxBacktracks)
+			{
+				FDecision Decision = Decisions.Pop();
+				NumBacktracks++;
+				YUKI_WFC_INC(Backtracks, SolveStats, 1);
+				UnwindTrail(Decision.TrailStart);
+				bContradiction = false;
+
+				// The tile that led to the contradiction is no longer an option for that cell.
+				const int PrevCount = Wave.GetCount(Decision.Cell);
+				Wave.Remove(Decision.Cell, Decision.Tile);
+				OnCellChanged(Decision.Cell, PrevCount, PrevCount == 1 ? Decision.Tile : INDEX_NONE);
+				if (Wave.GetCount(Decision.Cell) == 0)
+				{
+					bContradiction = true;
+					continue;
+				}
+				Propagate(MakeArrayView(&Decision.Cell, 1), Min, Max);
+				bRecovered = !bContradiction;
+			}
+			if (!bRecovered)
+			{
+				UE_LOG(LogWFC, Warning, TEXT("Could not resolve region %s - %s after %d backtracks."), *Min.ToString(), *Max.ToString(), NumBacktracks);
+				UnwindTrail(0);
+				TrailCells.Empty();
+				TrailMasks.Empty();
+				bContradiction = false;
+				return false;
+			}
+		}
+
+		YUKI_WFC_INC(Iterations, SolveStats, 1);
+		int Cell = INDEX_NONE;
+		{
+			YUKI_WFC_SCOPE(Select, SolveStats);
+			int MinEntropy = MAX_int32;
+			int NumCandidates = 0;
+			for (const int RegionCell : RegionCells)
+			{
+				const int Entropy = Wave.GetCount(RegionCell);
+				if (Entropy == 1 || Entropy > MinEntropy)
+				{
+					continue;
+				}
+				if (Entropy < MinEntropy)
+				{
+					MinEntropy = Entropy;
+					NumCandidates = 0;
+				}
+				if (Random.RandRange(0, NumCandidates++) == 0)
+				{
+					Cell = RegionCell;
+				}
+			}
+		}
+		if (Cell == INDEX_NONE)
+		{
+			TrailCells.Empty();
+			TrailMasks.Empty();
+			return true;
+		}
+
+		FDecision& Decision = Decisions.AddDefaulted_GetRef();
+		Decision.Cell = Cell;
+		Decision.TrailStart = TrailCells.Num();
+		{
+			YUKI_WFC_SCOPE(Collapse, SolveStats);
+			Decision.Tile = SelectTile(Cell);
+			if (Decision.Tile == INDEX_NONE)
+			{
+				Decisions.Pop();
+				bContradiction = true;
+				continue;
+			}
+			YUKI_WFC_INC(Collapses, SolveStats, 1);
+			CollapseTo(Cell, Decision.Tile);
 		}
+		Propagate(MakeArrayView(&Cell, 1), Min, Max);
 	}
 }
 
-FGameplayTagContainer UYukiWaveFunctionCollapseSolver::GetValidNeighbors(int Index, EYDWaveFunctionDirection Direction)
+void UYukiWaveFunctionCollapseSolver::RecordTrail(int Index)
+{
+	TrailCells.Add(Index);
+	TrailMasks.Append(Wave.GetMask(Index), Rules->NumWords);
+}
+
+void UYukiWaveFunctionCollapseSolver::UnwindTrail(int TrailStart)
+{
+	const int NumWords = Rules->NumWords;
+	TGuardValue<bool> RecordGuard(bRecordTrail, false);
+	// Newest first, a cell changed several times ends up with the options it had before the first change.
+	for (int i = TrailCells.Num() - 1; i >= TrailStart; i--)
+	{
+		SetCellMask(TrailCells[i], TrailMasks.GetData() + i * NumWords);
+	}
+	TrailCells.SetNum(TrailStart, false);
+	TrailMasks.SetNum(TrailStart * NumWords, false);
+}
+
+void UYukiWaveFunctionCollapseSolver::ConsumeDirtyCells(TArray<int>& OutCells, bool& bOutAllDirty)
+{
+	bOutAllDirty = bAllDirty;
+	OutCells = MoveTemp(DirtyCells);
+	for (const int Cell : OutCells)
+	{
+		DirtyMask[Cell] = false;
+	}
+	DirtyCells.Reset();
+	bAllDirty = false;
+}
+
+bool UYukiWaveFunctionCollapseSolver::RefreshRules()
+{
+	check(Model && Rules);
+	const TSharedRef<const FYukiWaveFunctionCollapseCompiledModel> NewRules = Model->GetSharedCompiledModel();
+	if (NewRules->ContentHash == Rules->ContentHash)
+	{
+		return true;
+	}
+	const bool bSameTiles = NewRules->TileSetHash == Rules->TileSetHash;
+	Rules = NewRules;
+	if (!bSameTiles)
+	{
+		UE_LOG(LogWFC, Log, TEXT("Tiles of %s changed, restarting the solver."), *Model->GetName());
+		InitCells();
+		return false;
+	}
+
+	// Tile indices are stable while the tile set is, so the collapsed cells can be checked against the new rows.
+	TArray<int> PrevTiles;
+	PrevTiles.SetNumUninitialized(Wave.Num());
+	int NumPrevCollapsed = 0;
+	for (int Cell = 0; Cell < Wave.Num(); Cell++)
+	{
+		PrevTiles[Cell] = GetCollapsedTileIndex(Cell);
+		NumPrevCollapsed += PrevTiles[Cell] != INDEX_NONE ? 1 : 0;
+	}
+	TArray<int> KeptCells;
+	for (int Cell = 0; Cell < Wave.Num(); Cell++)
+	{
+		const int Tile = PrevTiles[Cell];
+		if (Tile == INDEX_NONE)
+		{
+			continue;
+		}
+		bool bCompatible = true;
+		for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Rules->Topology))
+		{
+			int NeighborIndex;
+			if (GetNeighborCell(Rules->Topology, Size, Cell, Direction, NeighborIndex))
+			{
+				const int NeighborTile = PrevTiles[NeighborIndex];
+				bCompatible &= NeighborTile == INDEX_NONE || (Rules->GetPropagatorRow(Direction, Tile)[NeighborTile / 64] & (1ull << (NeighborTile % 64))) != 0;
+			}
+			else if (Rules->HasBorder(Direction))
+			{
+				bCompatible &= (Rules->GetBorderMask(Direction)[Tile / 64] & (1ull << (Tile % 64))) != 0;
+			}
+		}
+		if (bCompatible)
+		{
+			KeptCells.Add(Cell);
+		}
+	}
+
+	InitCells();
+	TArray<uint64, TInlineAllocator<4>> Mask;
+	Mask.SetNumUninitialized(Rules->NumWords);
+	for (const int Cell : KeptCells)
+	{
+		const int Tile = PrevTiles[Cell];
+		FMemory::Memzero(Mask.GetData(), Rules->NumWords * sizeof(uint64));
+		Mask[Tile / 64] |= 1ull << (Tile % 64);
+		ConstrainCell(Cell, Mask.GetData());
+		bContradiction |= Wave.GetCount(Cell) == 0;
+	}
+	if (!bContradiction)
+	{
+		Propagate(KeptCells, FIntVector::ZeroValue, Size);
+	}
+	if (bContradiction)
+	{
+		// The kept cells can not all be completed under the new rules.
+		UE_LOG(LogWFC, Log, TEXT("Collapsed cells of %s contradict the new rules, restarting the solver."), *Model->GetName());
+		InitCells();
+		return false;
+	}
+	UE_LOG(LogWFC, Log, TEXT("Kept %d of %d collapsed cells after the rules of %s changed."), KeptCells.Num(), NumPrevCollapsed, *Model->GetName());
+	return true;
+}
+
+FGameplayTagContainer UYukiWaveFunctionCollapseSolver::GetTagsForIndex(int Index) const
+{
+	return Rules->MaskToTags(Wave.GetMask(Index));
+}
+
+void UYukiWaveFunctionCollapseSolver::RemoveTagsFromUncollapsed(const FGameplayTagContainer& Tags)
 {
-	FGameplayTagContainer Container;
-	for (const auto& GameplayTag : Cells[Index].Options)
+	TArray<uint64, TInlineAllocator<4>> Mask;
+	Mask.SetNumUninitialized(Rules->NumWords);
+	Rules->TagsToMask(Tags, Mask.GetData());
+	TArray<uint64, TInlineAllocator<4>> KeepMask;
+	KeepMask.SetNumUninitialized(Rules->NumWords);
+	for (int Word = 0; Word < Rules->NumWords; Word++)
 	{
-		Container.AppendTags(Model->Tiles[GameplayTag].Options[Direction]);
+		KeepMask[Word] = ~Mask[Word];
 	}
-	// Remove neighbors that are past the count.
-	FGameplayTagContainer TagsToRemove;
-	for (const FGameplayTag& GameplayTag : Container)
+
+	for (int i = 0; i < Wave.Num(); i++)
 	{
-		int MaxCount = Model->Tiles[GameplayTag].MaxCount;
-		if (MaxCount != -1 && CountCellsWithTag(GameplayTag) >= MaxCount)
+		if (Wave.GetCount(i) > 1 && Wave.HasAny(i, Mask.GetData()))
 		{
-			TagsToRemove.AddTag(GameplayTag);
+			ConstrainCell(i, KeepMask.GetData());
+			PropagateFrom(i);
 		}
 	}
-	Container.RemoveTags(TagsToRemove);
-	return Container;
 }
+
 bool UYukiWaveFunctionCollapseSolver::RemoveTag(int Index, const FGameplayTag& Tag)
 {
-	Cells[Index].Options.RemoveTag(Tag);
-	return Cells[Index].Options.Num() > 0;
+	const int Tile = Rules->GetTileIndex(Tag);
+	if (Tile != INDEX_NONE)
+	{
+		const int PrevCount = Wave.GetCount(Index);
+		const int PrevTile = PrevCount == 1 ? Wave.GetFirstTile(Index) : INDEX_NONE;
+		if (Wave.Remove(Index, Tile))
+		{
+			OnCellChanged(Index, PrevCount, PrevTile);
+		}
+	}
+	return Wave.GetCount(Index) > 0;
+}
+
+bool UYukiWaveFunctionCollapseSolver::RestrictCell(int Index, const FGameplayTagContainer& Tags)
+{
+	TArray<uint64, TInlineAllocator<4>> Mask;
+	Mask.SetNumUninitialized(Rules->NumWords);
+	Rules->TagsToMask(Tags, Mask.GetData());
+	if (ConstrainCell(Index, Mask.GetData()) > 0)
+	{
+		bContradiction |= Wave.GetCount(Index) == 0;
+		if (!bContradiction)
+		{
+			PropagateFrom(Index);
+		}
+	}
+	return !bContradiction;
 }
 
 void UYukiWaveFunctionCollapseSolver::RemoveTagFromUncollapsedCells(const FGameplayTag& Tag)
 {
-	for (int i = 0; i < Cells.Num(); i++)
+	const int Tile = Rules->GetTileIndex(Tag);
+	if (Tile == INDEX_NONE)
 	{
-		if (Cells[i].Options.Num() == 1)
+		return;
+	}
+	for (int i = 0; i < Wave.Num(); i++)
+	{
+		if (Wave.GetCount(i) == 1)
 		{
 			continue;
 		}
-		if (Cells[i].Options.HasTag(Tag))
+		if (Wave.Has(i, Tile))
 		{
-			Cells[i].Options.RemoveTag(Tag);
+			const int PrevCount = Wave.GetCount(i);
+			Wave.Remove(i, Tile);
+			OnCellChanged(i, PrevCount, INDEX_NONE);
 			PropagateFrom(i);
 		}
 	}
 }
 float UYukiWaveFunctionCollapseSolver::CellHorizontalDistanceSquared(int IndexA, int IndexB) const
 {
-	int AX = IndexA % Size.X;
-	int AY = (IndexA / Size.X) % Size.Y;
-	int BX = IndexB % Size.X;
-	int BY = (IndexB / Size.X) % Size.Y;
-	return ((AX-BX)*(AX-BX)) + ((AY-BY)*(AY-BY));
+	const FVector Offset = GetCellOffset(Rules->Topology, Size, IndexA, IndexB);
+	return Offset.X * Offset.X + Offset.Y * Offset.Y;
 }
 
 int UYukiWaveFunctionCollapseSolver::CellWalkingDistance(int From, int To) const
 {
 	TArray<bool> Visited;
-	Visited.Reserve(Cells.Num());
-	for (int i = 0; i < Cells.Num(); i++)
+	Visited.Reserve(Wave.Num());
+	for (int i = 0; i < Wave.Num(); i++)
 	{
 		Visited.Add(false);
 	}
@@ -541,22 +1364,30 @@ TArray<TTuple<EYDWaveFunctionDirection, int>> UYukiWaveFunctionCollapseSolver::G
 {
 	// Return all valid directions from the given Index.
 	TArray<TTuple<EYDWaveFunctionDirection, int>> ValidNeighbors;
-	for (int i = 0; i < (int) EYDWaveFunctionDirection::MAX; i++)
+	VisitTopology(Rules->Topology, [&](auto Topology)
 	{
-		int NeighborIndex;
-		if (GetNeighborCell(Size, Index, (EYDWaveFunctionDirection) i, NeighborIndex))
+		decltype(Topology)::ForEachNeighbor(Size, Index, [&](EYDWaveFunctionDirection Direction, int NeighborIndex)
 		{
 			if (IsCellCollapsed(NeighborIndex))
 			{
-				ValidNeighbors.Add(TTuple<EYDWaveFunctionDirection, int>((EYDWaveFunctionDirection)i, NeighborIndex));
+				ValidNeighbors.Add(TTuple<EYDWaveFunctionDirection, int>(Direction, NeighborIndex));
 			}
-		}
-	}
+		});
+	});
 	return ValidNeighbors;	
 }
 bool UYukiWaveFunctionCollapseSolver::IsCellCollapsed(int Index) const
 {
-	return Cells[Index].Options.Num() == 1;
+	return Wave.GetCount(Index) == 1;
+}
+int UYukiWaveFunctionCollapseSolver::GetCollapsedTileIndex(int Index) const
+{
+	return IsCellCollapsed(Index) ? Wave.GetFirstTile(Index) : INDEX_NONE;
+}
+FGameplayTag UYukiWaveFunctionCollapseSolver::GetCollapsedTag(int Index) const
+{
+	const int Tile = GetCollapsedTileIndex(Index);
+	return Tile != INDEX_NONE ? Rules->TileTags[Tile] : FGameplayTag();
 }
 TArray<int> UYukiWaveFunctionCollapseSolver::GetWalkableNeighbors(int Index) const
 {
@@ -565,12 +1396,11 @@ TArray<int> UYukiWaveFunctionCollapseSolver::GetWalkableNeighbors(int Index) con
 		return TArray<int>{};
 	}
 	TArray<TTuple<EYDWaveFunctionDirection, int>> Neighbors = GetCollapsedNeighbors(Index);
-	FGameplayTag Tag = Cells[Index].Options.GetByIndex(0);
-	TSet<EYDWaveFunctionDirection> WalkableDirections = Model->Tiles[Tag].WalkDirections;
+	const uint32 WalkableDirections = Rules->WalkDirections[GetCollapsedTileIndex(Index)];
 	TArray<int> WalkableNeighbors;
 	for (const auto& Neighbor : Neighbors)
 	{
-		if (WalkableDirections.Contains(Neighbor.Get<0>()))
+		if (WalkableDirections & (1u << (uint32) Neighbor.Get<0>()))
 		{
 			WalkableNeighbors.Add(Neighbor.Get<1>());
 		}
@@ -581,13 +1411,13 @@ TArray<int> UYukiWaveFunctionCollapseSolver::GetWalkableNeighbors(int Index) con
 TArray<EYDWaveFunctionDirection> UYukiWaveFunctionCollapseSolver::ValidBorders(int Index) const
 {
 	TArray<EYDWaveFunctionDirection> ValidBorders;
-	for (int i = 0; i < (int) EYDWaveFunctionDirection::MAX; i++)
+	for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Rules->Topology))
 	{
 		int NeighborIndex;
-		if (!GetNeighborCell(Size, Index, (EYDWaveFunctionDirection) i, NeighborIndex))
+		if (!GetNeighborCell(Rules->Topology, Size, Index, Direction, NeighborIndex))
 		{
 			// Direction is a border.
-			ValidBorders.Add((EYDWaveFunctionDirection) i);
+			ValidBorders.Add(Direction);
 		}
 	}
 	return ValidBorders;
@@ -596,18 +1426,87 @@ TArray<EYDWaveFunctionDirection> UYukiWaveFunctionCollapseSolver::ValidBorders(i
 int UYukiWaveFunctionCollapseSolver::CountCellsWithTag(const FGameplayTag& Tag) const
 {
 	int OutCount = 0;
-	for (int i = 0; i < Cells.Num(); i++)
+	// Child tiles of Tag count as well, same as FGameplayTagContainer::HasTag.
+	ForEachMatchingTile(Tag, [&](int Tile)
 	{
-		if (!IsCellCollapsed(i))
+		OutCount += CollapsedCells.Num(Tile);
+	});
+	return OutCount;
+}
+
+TArray<int> UYukiWaveFunctionCollapseSolver::GetCellsByTagInRadius(const FGameplayTag& Tag, int Center, float Radius) const
+{
+	TArray<int> OutCells;
+	if (Center < 0 || Center >= Wave.Num() || Radius < 0.0f)
+	{
+		return OutCells;
+	}
+	const FIntVector C(Center % Size.X, (Center / Size.X) % Size.Y, Center / (Size.X * Size.Y));
+	const float RadiusSquared = Radius * Radius;
+	auto IsInRadius = [&](int Cell)
+	{
+		return GetCellOffset(Rules->Topology, Size, Center, Cell).SizeSquared() <= RadiusSquared;
+	};
+
+	TBitArray<> Matching(false, Rules->NumTiles());
+	int NumCandidates = 0;
+	ForEachMatchingTile(Tag, [&](int Tile)
+	{
+		Matching[Tile] = true;
+		NumCandidates += CollapsedCells.Num(Tile);
+	});
+
+	// Walk whichever is smaller, the cells of the matching tiles or the box around the sphere.
+	const int R = FMath::FloorToInt(Radius);
+	const FIntVector Min(FMath::Max(C.X - R, 0), FMath::Max(C.Y - R, 0), FMath::Max(C.Z - R, 0));
+	const FIntVector Max(FMath::Min(C.X + R + 1, Size.X), FMath::Min(C.Y + R + 1, Size.Y), FMath::Min(C.Z + R + 1, Size.Z));
+	const int64 BoxVolume = (int64) (Max.X - Min.X) * (Max.Y - Min.Y) * (Max.Z - Min.Z);
+	// The box only bounds the sphere in cube grids without wrapping.
+	if (BoxVolume < NumCandidates && Rules->Topology == EYukiWaveFunctionCollapseTopology::Cube)
+	{
+		for (int Z = Min.Z; Z < Max.Z; Z++)
 		{
-			continue;
+			for (int Y = Min.Y; Y < Max.Y; Y++)
+			{
+				for (int X = Min.X; X < Max.X; X++)
+				{
+					const int Cell = X + (Y * Size.X) + (Z * Size.X * Size.Y);
+					const int Tile = GetCollapsedTileIndex(Cell);
+					if (Tile != INDEX_NONE && Matching[Tile] && IsInRadius(Cell))
+					{
+						OutCells.Add(Cell);
+					}
+				}
+			}
 		}
-		if (Cells[i].Options.HasTag(Tag))
+		return OutCells;
+	}
+
+	ForEachCollapsedCell(Tag, [&](int Cell)
+	{
+		if (IsInRadius(Cell))
+		{
+			OutCells.Add(Cell);
+		}
+	});
+	OutCells.Sort();
+	return OutCells;
+}
+
+TArray<int> UYukiWaveFunctionCollapseSolver::GetCollapsedCellsByMask(const uint64* Mask) const
+{
+	TArray<int> OutCells;
+	for (int Word = 0; Word < Rules->NumWords; Word++)
+	{
+		uint64 Bits = Mask[Word];
+		while (Bits)
 		{
-			OutCount++;
+			OutCells.Append(CollapsedCells.GetCells(Word * 64 + (int) FMath::CountTrailingZeros64(Bits)));
+			Bits &= Bits - 1;
 		}
 	}
-	return OutCount;
+	OutCells.Sort();
+	return OutCells;
 }
 
 void UYukiWaveFunctionCollapseSolverDecorator_MutuallyExclusive::OnCellCollapsed(int Cell, const FGameplayTag& Tag, UYukiWaveFunctionCollapseSolver* Solver)
@@ -0,0 +1,222 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseNavGraph.h"
+
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Algo/Reverse.h"
+
+DECLARE_CYCLE_STAT(TEXT("Nav Graph Update"), STAT_YukiWFC_NavGraphUpdate, STATGROUP_YukiWFC);
+DECLARE_CYCLE_STAT(TEXT("Nav Graph Path"), STAT_YukiWFC_NavGraphPath, STATGROUP_YukiWFC);
+
+void FYukiWaveFunctionCollapseNavGraph::Build(const UYukiWaveFunctionCollapseSolver& Solver)
+{
+	Reset();
+	Update(Solver);
+}
+
+void FYukiWaveFunctionCollapseNavGraph::Reset()
+{
+	Size = FIntVector::ZeroValue;
+	RulesHash = 0;
+	CellTiles.Reset();
+	Links.Reset();
+}
+
+int FYukiWaveFunctionCollapseNavGraph::Update(const UYukiWaveFunctionCollapseSolver& Solver, TArray<int>* OutChangedCells)
+{
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_NavGraphUpdate);
+	const FYukiWaveFunctionCollapseCompiledModel& Rules = Solver.GetRules();
+	const int NumCells = Solver.NumCells();
+	if (Resize(Rules, Solver.Size))
+	{
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			CellTiles[Cell] = Solver.GetCollapsedTileIndex(Cell);
+		}
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			LinkCell(Rules, Cell, OutChangedCells);
+		}
+		return NumCells;
+	}
+
+	TArray<int> ChangedTiles;
+	for (int Cell = 0; Cell < NumCells; Cell++)
+	{
+		const int Tile = Solver.GetCollapsedTileIndex(Cell);
+		if (CellTiles[Cell] != Tile)
+		{
+			CellTiles[Cell] = Tile;
+			ChangedTiles.Add(Cell);
+		}
+	}
+	RelinkCells(Rules, ChangedTiles, OutChangedCells);
+	return ChangedTiles.Num();
+}
+
+int FYukiWaveFunctionCollapseNavGraph::UpdateCells(const FYukiWaveFunctionCollapseCompiledModel& Rules, FIntVector InSize, TConstArrayView<int> InCellTiles, TConstArrayView<int> Cells, TArray<int>* OutChangedCells)
+{
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_NavGraphUpdate);
+	const int NumCells = InSize.X * InSize.Y * InSize.Z;
+	check(InCellTiles.Num() == NumCells);
+	if (Resize(Rules, InSize))
+	{
+		FMemory::Memcpy(CellTiles.GetData(), InCellTiles.GetData(), NumCells * sizeof(int));
+		for (int Cell = 0; Cell < NumCells; Cell++)
+		{
+			LinkCell(Rules, Cell, OutChangedCells);
+		}
+		return NumCells;
+	}
+
+	TArray<int> ChangedTiles;
+	for (const int Cell : Cells)
+	{
+		if (CellTiles[Cell] != InCellTiles[Cell])
+		{
+			CellTiles[Cell] = InCellTiles[Cell];
+			ChangedTiles.Add(Cell);
+		}
+	}
+	RelinkCells(Rules, ChangedTiles, OutChangedCells);
+	return ChangedTiles.Num();
+}
+
+bool FYukiWaveFunctionCollapseNavGraph::Resize(const FYukiWaveFunctionCollapseCompiledModel& Rules, FIntVector InSize)
+{
+	const int NumCells = InSize.X * InSize.Y * InSize.Z;
+	if (Size == InSize && Topology == Rules.Topology && RulesHash == Rules.ContentHash && CellTiles.Num() == NumCells)
+	{
+		return false;
+	}
+	Topology = Rules.Topology;
+	Size = InSize;
+	RulesHash = Rules.ContentHash;
+	Links.Init(0, NumCells);
+	CellTiles.SetNumUninitialized(NumCells);
+	return true;
+}
+
+void FYukiWaveFunctionCollapseNavGraph::RelinkCells(const FYukiWaveFunctionCollapseCompiledModel& Rules, TConstArrayView<int> ChangedTiles, TArray<int>* OutChangedCells)
+{
+	// A cell's links depend on its own tile and on which neighbors are collapsed.
+	const TConstArrayView<EYDWaveFunctionDirection> Directions = GetTopologyDirections(Topology);
+	for (const int Cell : ChangedTiles)
+	{
+		LinkCell(Rules, Cell, OutChangedCells);
+		for (const EYDWaveFunctionDirection Direction : Directions)
+		{
+			int NeighborIndex;
+			if (GetNeighborCell(Topology, Size, Cell, Direction, NeighborIndex))
+			{
+				LinkCell(Rules, NeighborIndex, OutChangedCells);
+			}
+		}
+	}
+}
+
+void FYukiWaveFunctionCollapseNavGraph::LinkCell(const FYukiWaveFunctionCollapseCompiledModel& Rules, int Cell, TArray<int>* OutChangedCells)
+{
+	uint32 CellLinks = 0;
+	const int Tile = CellTiles[Cell];
+	if (Tile != INDEX_NONE)
+	{
+		const uint32 Walk = Rules.WalkDirections[Tile];
+		for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Topology))
+		{
+			int NeighborIndex;
+			if ((Walk & (1u << (uint32) Direction)) && GetNeighborCell(Topology, Size, Cell, Direction, NeighborIndex) && CellTiles[NeighborIndex] != INDEX_NONE)
+			{
+				CellLinks |= 1u << (uint32) Direction;
+			}
+		}
+	}
+	if (Links[Cell] != CellLinks)
+	{
+		Links[Cell] = CellLinks;
+		if (OutChangedCells)
+		{
+			OutChangedCells->Add(Cell);
+		}
+	}
+}
+
+bool FYukiWaveFunctionCollapseNavGraph::FindPath(int From, int To, TArray<int>& OutPath) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_NavGraphPath);
+	OutPath.Reset();
+	if (!Links.IsValidIndex(From) || !Links.IsValidIndex(To))
+	{
+		return false;
+	}
+
+	// Every link costs the same, so breadth first finds the shortest path.
+	TArray<int> Parents;
+	Parents.Init(INDEX_NONE, Links.Num());
+	Parents[From] = From;
+	TArray<int> Queue;
+	Queue.Add(From);
+	const TConstArrayView<EYDWaveFunctionDirection> Directions = GetTopologyDirections(Topology);
+	for (int Head = 0; Head < Queue.Num() && Parents[To] == INDEX_NONE; Head++)
+	{
+		const int Cell = Queue[Head];
+		const uint32 CellLinks = Links[Cell];
+		for (const EYDWaveFunctionDirection Direction : Directions)
+		{
+			int NeighborIndex;
+			if ((CellLinks & (1u << (uint32) Direction)) && GetNeighborCell(Topology, Size, Cell, Direction, NeighborIndex) && Parents[NeighborIndex] == INDEX_NONE)
+			{
+				Parents[NeighborIndex] = Cell;
+				Queue.Add(NeighborIndex);
+			}
+		}
+	}
+	if (Parents[To] == INDEX_NONE)
+	{
+		return false;
+	}
+	for (int Cell = To; Cell != From; Cell = Parents[Cell])
+	{
+		OutPath.Add(Cell);
+	}
+	OutPath.Add(From);
+	Algo::Reverse(OutPath);
+	return true;
+}
+
+int FYukiWaveFunctionCollapseNavGraph::FindNearestCell(const FVector& Location) const
+{
+	if (Links.Num() == 0)
+	{
+		return INDEX_NONE;
+	}
+	const bool bHex = Topology == EYukiWaveFunctionCollapseTopology::HexPrism;
+	const float RowHeight = bHex ? FYukiWaveFunctionCollapseHexPrismTopology::RowHeight : 1.0f;
+	const int Y = FMath::Clamp(FMath::RoundToInt(Location.Y / RowHeight), 0, Size.Y - 1);
+	const int Z = FMath::Clamp(FMath::RoundToInt(Location.Z), 0, Size.Z - 1);
+	const int X = FMath::Clamp(FMath::RoundToInt(Location.X - (bHex && (Y & 1) ? 0.5f : 0.0f)), 0, Size.X - 1);
+	int Nearest = X + (Y * Size.X) + (Z * Size.X * Size.Y);
+	if (!bHex)
+	{
+		return Nearest;
+	}
+	// Rounding to the closest row can pick the wrong one near the corners of a hexagon, the closest center
+	// is then one of the neighbors.
+	const int Rounded = Nearest;
+	float NearestDistance = FVector::DistSquared(GetCellLocation(Topology, Size, Rounded), Location);
+	for (const EYDWaveFunctionDirection Direction : GetTopologyDirections(Topology))
+	{
+		int NeighborIndex;
+		if (GetNeighborCell(Topology, Size, Rounded, Direction, NeighborIndex))
+		{
+			const float Distance = FVector::DistSquared(GetCellLocation(Topology, Size, NeighborIndex), Location);
+			if (Distance < NearestDistance)
+			{
+				NearestDistance = Distance;
+				Nearest = NeighborIndex;
+			}
+		}
+	}
+	return Nearest;
+}
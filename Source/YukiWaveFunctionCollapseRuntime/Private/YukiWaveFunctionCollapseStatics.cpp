@@ -27,3 +27,12 @@ AActor* UYukiWaveFunctionCollapseStatics::SpawnActorFromSolver(UObject* WorldCon
 
 	return ContainerActor;
 }
+
+FYukiWaveFunctionCollapseMetrics UYukiWaveFunctionCollapseStatics::ComputeSolveMetrics(UYukiWaveFunctionCollapseSolver* Solver, const FYukiWaveFunctionCollapseMetricsSettings& Settings)
+{
+	if (!Solver || Solver->NumCells() == 0)
+	{
+		return FYukiWaveFunctionCollapseMetrics();
+	}
+	return FYukiWaveFunctionCollapseMetrics::Compute(*Solver, Settings);
+}
@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseStats.h"
+
+DEFINE_STAT(STAT_YukiWFC_Init);
+DEFINE_STAT(STAT_YukiWFC_Select);
+DEFINE_STAT(STAT_YukiWFC_Collapse);
+DEFINE_STAT(STAT_YukiWFC_Propagate);
+
+DEFINE_STAT(STAT_YukiWFC_Iterations);
+DEFINE_STAT(STAT_YukiWFC_Collapses);
+DEFINE_STAT(STAT_YukiWFC_PropagationPops);
+DEFINE_STAT(STAT_YukiWFC_Eliminations);
+DEFINE_STAT(STAT_YukiWFC_Contradictions);
+DEFINE_STAT(STAT_YukiWFC_Restarts);
+DEFINE_STAT(STAT_YukiWFC_Backtracks);
+DEFINE_STAT(STAT_YukiWFC_BytesAllocated);
+
+FString FYukiWaveFunctionCollapseSolveStats::ToString() const
+{
+	return FString::Printf(
+		TEXT("Iterations=%d Collapses=%d Pops=%d Eliminations=%d Contradictions=%d Restarts=%d Backtracks=%d PeakWorklist=%d Bytes=%lld PeakBytes=%lld Init=%.3fms Select=%.3fms Collapse=%.3fms Propagate=%.3fms"),
+		Iterations, Collapses, PropagationPops, Eliminations, Contradictions, Restarts, Backtracks, PeakWorklistSize, BytesAllocated, PeakBytesAllocated,
+		InitSeconds * 1000.0, SelectSeconds * 1000.0, CollapseSeconds * 1000.0, PropagateSeconds * 1000.0);
+}
@@ -0,0 +1,166 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseStreamingSolver.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "YukiWaveFunctionCollapseModel.h"
+#include "Async/Async.h"
+
+namespace YukiWaveFunctionCollapseStreamingSolver
+{
+	// Batches in flight between the worker and the game thread.
+	constexpr uint32 QueueCapacity = 256;
+}
+
+void UYukiWaveFunctionCollapseStreamingSolver::BeginDestroy()
+{
+	Cancel();
+	Super::BeginDestroy();
+}
+
+void UYukiWaveFunctionCollapseStreamingSolver::Start(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, int32 InSeed, int32 FocusCell, float FocusBias)
+{
+	check(IsInGameThread());
+	Cancel();
+	// The solver and the initial state are created here, the worker only iterates.
+	Solver = NewObject<UYukiWaveFunctionCollapseSolver>(this);
+	Solver->Init(InModel, InSize, FRandomStream(InSeed));
+	Solver->SetFocus(FocusCell, FocusBias);
+	Seed = InSeed;
+
+	Queue = MakeUnique<TCircularQueue<FBatch>>(YukiWaveFunctionCollapseStreamingSolver::QueueCapacity);
+	Pending.Reset();
+	PendingHead = 0;
+	bCancel = false;
+	bSolved = false;
+	bWorkerDone = false;
+	Worker = Async(EAsyncExecution::ThreadPool, [this]()
+	{
+		RunWorker();
+	});
+}
+
+void UYukiWaveFunctionCollapseStreamingSolver::Cancel()
+{
+	bCancel = true;
+	if (Worker.IsValid())
+	{
+		Worker.Wait();
+		Worker = TFuture<void>();
+	}
+	bWorkerDone = true;
+}
+
+void UYukiWaveFunctionCollapseStreamingSolver::RunWorker()
+{
+	FBatch Batch;
+	TArray<int> DirtyCells;
+	bool bAllDirty = false;
+	int NumRestarts = 0;
+	while (!bCancel)
+	{
+		// Cells collapsed by the last iteration, or every cell of a fresh wave.
+		Solver->ConsumeDirtyCells(DirtyCells, bAllDirty);
+		if (!Solver->HasContradiction())
+		{
+			const int NumCells = bAllDirty ? Solver->NumCells() : DirtyCells.Num();
+			for (int i = 0; i < NumCells; i++)
+			{
+				const int Cell = bAllDirty ? i : DirtyCells[i];
+				const int Tile = Solver->GetCollapsedTileIndex(Cell);
+				if (Tile != INDEX_NONE)
+				{
+					Batch.Cells.Add({Cell, Tile});
+				}
+			}
+		}
+		if ((Batch.bRestart || Batch.Cells.Num() >= BatchSize) && !Publish(Batch))
+		{
+			break;
+		}
+		if (Solver->IsSolved())
+		{
+			break;
+		}
+
+		if (Solver->HasContradiction())
+		{
+			if (MaxRestarts != -1 && NumRestarts >= MaxRestarts)
+			{
+				UE_LOG(LogWFC, Warning, TEXT("Streaming solve gave up after %d restarts."), NumRestarts);
+				break;
+			}
+			// Seeds derived from the start seed, so a streamed solve is as reproducible as SolveFully.
+			const int32 RestartSeed = (int32) HashCombine(GetTypeHash(Seed), GetTypeHash(++NumRestarts));
+			UE_LOG(LogWFC, Log, TEXT("Streaming solve hit a contradiction, restarting with seed %d."), RestartSeed);
+			Solver->Reset(RestartSeed);
+			Batch.Cells.Reset();
+			Batch.bRestart = true;
+			if (Solver->HasContradiction())
+			{
+				UE_LOG(LogWFC, Error, TEXT("The borders of %s cannot be satisfied at size %s."), *Solver->Model->GetPathName(), *Solver->Size.ToString());
+				break;
+			}
+			continue;
+		}
+		Solver->SingleIteration();
+	}
+	if (!bCancel && (Batch.bRestart || Batch.Cells.Num() > 0))
+	{
+		Publish(Batch);
+	}
+	bSolved = Solver->IsSolved();
+	bWorkerDone = true;
+}
+
+bool UYukiWaveFunctionCollapseStreamingSolver::Publish(FBatch& Batch)
+{
+	while (Queue->IsFull())
+	{
+		if (bCancel)
+		{
+			return false;
+		}
+		FPlatformProcess::Sleep(0.001f);
+	}
+	Queue->Enqueue(MoveTemp(Batch));
+	Batch = FBatch();
+	return true;
+}
+
+void UYukiWaveFunctionCollapseStreamingSolver::Poll(int MaxCells, TArray<FYukiWaveFunctionCollapseStreamedCell>& OutCells, bool& bOutRestarted)
+{
+	check(IsInGameThread());
+	OutCells.Reset();
+	bOutRestarted = false;
+	if (!Queue)
+	{
+		return;
+	}
+	FBatch Batch;
+	while (Queue->Dequeue(Batch))
+	{
+		if (Batch.bRestart)
+		{
+			Pending.Reset();
+			PendingHead = 0;
+			bOutRestarted = true;
+		}
+		Pending.Append(MoveTemp(Batch.Cells));
+	}
+
+	const int NumCells = FMath::Min(MaxCells, Pending.Num() - PendingHead);
+	OutCells.Append(Pending.GetData() + PendingHead, NumCells);
+	PendingHead += NumCells;
+	if (PendingHead == Pending.Num())
+	{
+		Pending.Reset();
+		PendingHead = 0;
+	}
+}
+
+bool UYukiWaveFunctionCollapseStreamingSolver::IsFinished() const
+{
+	return bWorkerDone && (!Queue || Queue->IsEmpty()) && PendingHead == Pending.Num();
+}
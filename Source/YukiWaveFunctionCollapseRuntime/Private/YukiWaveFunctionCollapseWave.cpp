@@ -0,0 +1,220 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "YukiWaveFunctionCollapseWave.h"
+
+#include "YukiWaveFunctionCollapseLog.h"
+#include "Misc/ScopeLock.h"
+
+void FYukiWaveFunctionCollapseWave::Init(int InNumCells, int InNumWords, const uint64* AllMask, int InNumTiles)
+{
+	// Collapsed tiles share the state word with the sentinels and the partial bit, and pooled counts are
+	// stored as uint16.
+	checkf(InNumTiles <= MAX_uint16, TEXT("Waves support at most %d tiles, got %d."), MAX_uint16, InNumTiles);
+	NumCells = InNumCells;
+	NumWords = InNumWords;
+	NumTiles = InNumTiles;
+
+	const TSharedPtr<FMaskTable> NewMasks = MakeShared<FMaskTable>();
+	NewMasks->NumWords = NumWords;
+	NewMasks->NumTiles = NumTiles;
+	NewMasks->Rows.Init(0, (NumTiles + 2) * NumWords);
+	for (int Tile = 0; Tile < NumTiles; Tile++)
+	{
+		NewMasks->Rows[Tile * NumWords + Tile / 64] = 1ull << (Tile % 64);
+	}
+	FMemory::Memcpy(NewMasks->Rows.GetData() + NumTiles * NumWords, AllMask, NumWords * sizeof(uint64));
+	Masks = NewMasks;
+
+	States.Init(NumTiles == 1 ? 0 : NumTiles == 0 ? NoOptions : AllOptions, NumCells);
+	PoolBits.Reset();
+	PoolCounts.Reset();
+	FreeSlots.Reset();
+}
+
+void FYukiWaveFunctionCollapseWave::SetMask(int Cell, const uint64* Mask, int Count)
+{
+	Store(Cell, Mask, Count);
+}
+
+int FYukiWaveFunctionCollapseWave::Intersect(int Cell, const uint64* Mask)
+{
+	const uint32 State = States[Cell];
+	if (State == NoOptions)
+	{
+		return 0;
+	}
+	if (!(State & PartialBit))
+	{
+		if (Mask[State / 64] & (1ull << (State % 64)))
+		{
+			return 0;
+		}
+		States[Cell] = NoOptions;
+		return 1;
+	}
+
+	const uint64* CellMask = GetMask(Cell);
+	TArray<uint64, TInlineAllocator<4>> Result;
+	Result.SetNumUninitialized(NumWords);
+	int Count = 0;
+	for (int Word = 0; Word < NumWords; Word++)
+	{
+		Result[Word] = CellMask[Word] & Mask[Word];
+		Count += (int) FMath::CountBits(Result[Word]);
+	}
+	const int Removed = GetCount(Cell) - Count;
+	if (Removed > 0)
+	{
+		Store(Cell, Result.GetData(), Count);
+	}
+	return Removed;
+}
+
+bool FYukiWaveFunctionCollapseWave::Remove(int Cell, int Tile)
+{
+	if (!Has(Cell, Tile))
+	{
+		return false;
+	}
+	TArray<uint64, TInlineAllocator<4>> Result;
+	Result.SetNumUninitialized(NumWords);
+	FMemory::Memcpy(Result.GetData(), GetMask(Cell), NumWords * sizeof(uint64));
+	Result[Tile / 64] &= ~(1ull << (Tile % 64));
+	Store(Cell, Result.GetData(), GetCount(Cell) - 1);
+	return true;
+}
+
+void FYukiWaveFunctionCollapseWave::Store(int Cell, const uint64* Mask, int Count)
+{
+	uint32& State = States[Cell];
+	if (Count == 0 || Count == 1 || Count == NumTiles)
+	{
+		ReleaseSlot(Cell);
+		if (Count == 0)
+		{
+			State = NoOptions;
+		}
+		else if (Count == NumTiles)
+		{
+			State = AllOptions;
+		}
+		else
+		{
+			for (int Word = 0; Word < NumWords; Word++)
+			{
+				if (Mask[Word])
+				{
+					State = (uint32) (Word * 64 + FMath::CountTrailingZeros64(Mask[Word]));
+					break;
+				}
+			}
+		}
+		return;
+	}
+	if (State == AllOptions || State == NoOptions || !(State & PartialBit))
+	{
+		State = AllocateSlot() | PartialBit;
+	}
+	const uint32 Slot = State & ~PartialBit;
+	FMemory::Memcpy(PoolBits.GetData() + Slot * NumWords, Mask, NumWords * sizeof(uint64));
+	PoolCounts[Slot] = (uint16) Count;
+}
+
+void FYukiWaveFunctionCollapseWave::ReleaseSlot(int Cell)
+{
+	const uint32 State = States[Cell];
+	if ((State & PartialBit) && State != AllOptions && State != NoOptions)
+	{
+		FreeSlots.Push(State & ~PartialBit);
+	}
+}
+
+uint32 FYukiWaveFunctionCollapseWave::AllocateSlot()
+{
+	if (FreeSlots.Num() > 0)
+	{
+		return FreeSlots.Pop();
+	}
+	const uint32 Slot = PoolCounts.Num();
+	check(Slot < NoOptions - PartialBit);
+	PoolCounts.Add(0);
+	PoolBits.AddUninitialized(NumWords);
+	return Slot;
+}
+
+FYukiWaveFunctionCollapseInitialStateCache& FYukiWaveFunctionCollapseInitialStateCache::Get()
+{
+	static FYukiWaveFunctionCollapseInitialStateCache Cache;
+	return Cache;
+}
+
+TSharedPtr<const FYukiWaveFunctionCollapseInitialState> FYukiWaveFunctionCollapseInitialStateCache::Find(uint64 ContentHash, const FIntVector& Size)
+{
+	FScopeLock ScopeLock(&Lock);
+	FEntry* Entry = States.Find(MakeTuple(ContentHash, Size));
+	if (!Entry)
+	{
+		return nullptr;
+	}
+	Entry->LastUse = ++UseCounter;
+	return Entry->State;
+}
+
+TSharedPtr<const FYukiWaveFunctionCollapseInitialState> FYukiWaveFunctionCollapseInitialStateCache::Add(uint64 ContentHash, const FIntVector& Size, TSharedPtr<const FYukiWaveFunctionCollapseInitialState> State)
+{
+	FScopeLock ScopeLock(&Lock);
+	const TTuple<uint64, FIntVector> Key = MakeTuple(ContentHash, Size);
+	if (FEntry* Existing = States.Find(Key))
+	{
+		Existing->LastUse = ++UseCounter;
+		return Existing->State;
+	}
+	FEntry& Entry = States.Add(Key);
+	Entry.Bytes = sizeof(FYukiWaveFunctionCollapseInitialState) + State->Wave.GetAllocatedSize() + State->CollapsedCells.GetAllocatedSize();
+	Entry.LastUse = ++UseCounter;
+	Entry.State = MoveTemp(State);
+	TotalBytes += Entry.Bytes;
+	TSharedPtr<const FYukiWaveFunctionCollapseInitialState> Result = Entry.State;
+	Trim();
+	return Result;
+}
+
+void FYukiWaveFunctionCollapseInitialStateCache::Empty()
+{
+	FScopeLock ScopeLock(&Lock);
+	States.Empty();
+	TotalBytes = 0;
+}
+
+void FYukiWaveFunctionCollapseInitialStateCache::SetMaxBytes(SIZE_T InMaxBytes)
+{
+	FScopeLock ScopeLock(&Lock);
+	MaxBytes = InMaxBytes;
+	Trim();
+}
+
+SIZE_T FYukiWaveFunctionCollapseInitialStateCache::GetAllocatedSize() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return TotalBytes + States.GetAllocatedSize();
+}
+
+void FYukiWaveFunctionCollapseInitialStateCache::Trim()
+{
+	// Only a handful of sizes are in use at once, a scan is cheaper than keeping a list in order.
+	while (TotalBytes > MaxBytes && States.Num() > 1)
+	{
+		auto Oldest = States.CreateIterator();
+		for (auto It = States.CreateIterator(); It; ++It)
+		{
+			if (It->Value.LastUse < Oldest->Value.LastUse)
+			{
+				Oldest = It;
+			}
+		}
+		UE_LOG(LogWFC, Verbose, TEXT("Evicting the initial state of size %s from the cache."), *Oldest->Key.Get<1>().ToString());
+		TotalBytes -= Oldest->Value.Bytes;
+		Oldest.RemoveCurrent();
+	}
+}
@@ -0,0 +1,141 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+class UYukiWaveFunctionCollapseSolver;
+
+/**
+ * Batch files store many solved maps of the same model and size:
+ *
+ *   Header | Chunk 0 records | Chunk 1 records | ... | Chunk index
+ *
+ * Every record is a FYukiWaveFunctionCollapseBatchRecord followed by one uint16 tile index per cell,
+ * padded to 8 bytes. All records have the same size, so the file can be memory-mapped and indexed directly.
+ */
+struct FYukiWaveFunctionCollapseBatchFileHeader
+{
+	static constexpr uint32 MagicValue = 0x43465759; // "YWFC"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = MagicValue;
+	uint32 Version = CurrentVersion;
+	int32 SizeX = 0;
+	int32 SizeY = 0;
+	int32 SizeZ = 0;
+	int32 NumTiles = 0;
+	uint64 ContentHash = 0;
+	int32 NumRecords = 0;
+	int32 RecordsPerChunk = 0;
+	int32 NumChunks = 0;
+	uint32 RecordSize = 0;
+	uint64 IndexOffset = 0;
+};
+static_assert(sizeof(FYukiWaveFunctionCollapseBatchFileHeader) == 56, "Batch file header layout changed.");
+
+struct FYukiWaveFunctionCollapseBatchChunk
+{
+	uint64 Offset = 0;
+	int32 FirstRecord = 0;
+	int32 NumRecords = 0;
+};
+static_assert(sizeof(FYukiWaveFunctionCollapseBatchChunk) == 16, "Batch file chunk layout changed.");
+
+struct FYukiWaveFunctionCollapseBatchRecord
+{
+	// Written in place of a tile index for cells that did not collapse.
+	static constexpr uint16 UncollapsedTile = MAX_uint16;
+
+	enum EFlags : uint32
+	{
+		Solved = 1 << 0,
+		// Stopped early because a requirement could no longer be met.
+		Rejected = 1 << 1,
+		// Ran out of restarts without solving, see UYukiWaveFunctionCollapseSolver::MaxRestarts.
+		GaveUp = 1 << 2,
+	};
+
+	int32 Seed = 0;
+	uint32 Flags = 0;
+	int32 Iterations = 0;
+	int32 Collapses = 0;
+	int32 PropagationPops = 0;
+	int32 Eliminations = 0;
+	int32 Contradictions = 0;
+	int32 Restarts = 0;
+	int32 Backtracks = 0;
+	int32 PeakWorklistSize = 0;
+	// Peak bytes held by the solver's cell state during the solve.
+	int64 BytesAllocated = 0;
+	float InitMs = 0.0f;
+	float SelectMs = 0.0f;
+	float CollapseMs = 0.0f;
+	float PropagateMs = 0.0f;
+
+	bool IsSolved() const { return (Flags & Solved) != 0; }
+	bool IsRejected() const { return (Flags & Rejected) != 0; }
+	bool HasGivenUp() const { return (Flags & GaveUp) != 0; }
+};
+static_assert(sizeof(FYukiWaveFunctionCollapseBatchRecord) == 64, "Batch file record layout changed.");
+
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseBatchWriter
+{
+public:
+	~FYukiWaveFunctionCollapseBatchWriter();
+
+	bool Open(const FString& Filename, const FIntVector& Size, int NumTiles, uint64 ContentHash, int RecordsPerChunk);
+
+	// Appends a chunk. RecordData holds NumRecords records of GetRecordSize() bytes.
+	void WriteChunk(int NumRecords, TConstArrayView<uint8> RecordData);
+
+	// Writes the chunk index and finalizes the header.
+	bool Close();
+
+	uint32 GetRecordSize() const { return Header.RecordSize; }
+
+	// Writes the seed, stats and collapsed tiles of a solver into a record of GetRecordSize() bytes.
+	static void FillRecord(uint8* Dest, int32 Seed, const UYukiWaveFunctionCollapseSolver& Solver);
+
+	static uint32 ComputeRecordSize(int NumCells);
+
+private:
+	TUniquePtr<FArchive> Writer;
+	FYukiWaveFunctionCollapseBatchFileHeader Header;
+	TArray<FYukiWaveFunctionCollapseBatchChunk> Chunks;
+};
+
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseBatchReader
+{
+public:
+	FYukiWaveFunctionCollapseBatchReader();
+	~FYukiWaveFunctionCollapseBatchReader();
+
+	// Memory-maps a batch file. Returns false if it is missing, not a batch file, or its header or chunk
+	// index point outside of the file.
+	bool Open(const FString& Filename);
+
+	const FYukiWaveFunctionCollapseBatchFileHeader& GetHeader() const { return Header; }
+	FIntVector GetSize() const { return FIntVector(Header.SizeX, Header.SizeY, Header.SizeZ); }
+	int Num() const { return Header.NumRecords; }
+
+	TConstArrayView<FYukiWaveFunctionCollapseBatchChunk> GetChunks() const { return Chunks; }
+
+	const FYukiWaveFunctionCollapseBatchRecord& GetRecord(int Index) const;
+
+	// Tile index of every cell of a record, UncollapsedTile for cells that did not collapse.
+	TConstArrayView<uint16> GetTiles(int Index) const;
+
+private:
+	// Checks the header and the chunk index against the mapped size and sets up Chunks.
+	bool ValidateLayout(uint64 FileSize);
+	const uint8* GetRecordData(int Index) const;
+
+	TUniquePtr<IMappedFileHandle> MappedHandle;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	const uint8* Data = nullptr;
+	FYukiWaveFunctionCollapseBatchFileHeader Header;
+	TConstArrayView<FYukiWaveFunctionCollapseBatchChunk> Chunks;
+};
@@ -0,0 +1,185 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameplayTagContainer.h"
+#include "YukiWaveFunctionCollapseTopology.h"
+#include "YukiWaveFunctionCollapseCompiledModel.generated.h"
+
+class UYukiWaveFunctionCollapseModel;
+
+/**
+ * FYukiWaveFunctionCollapseCompiledModel
+ *
+ * Validated, dense form of a UYukiWaveFunctionCollapseModel. Tiles are addressed by index and every
+ * adjacency rule is a bitmask of NumWords 64 bit words, so solvers never touch the authoring TMaps.
+ * Built when the model is saved or cooked and serialized with it.
+ */
+USTRUCT()
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseCompiledModel
+{
+	GENERATED_BODY()
+
+public:
+	// Bump when the compiled layout changes so stale data is rebuilt on load.
+	static constexpr uint64 CompiledVersion = 5;
+
+	/**
+	 * Hash of every rule the table was compiled from, 0 when not compiled.
+	 */
+	UPROPERTY()
+	uint64 ContentHash = 0;
+
+	/**
+	 * Hash of the topology and the tile tags. While it matches, edits only recompile the tiles that changed.
+	 */
+	UPROPERTY()
+	uint64 TileSetHash = 0;
+
+	/**
+	 * Hash of the rules of every tile, to find the tiles an edit changed.
+	 */
+	UPROPERTY()
+	TArray<uint64> TileHashes;
+
+	/**
+	 * Hash of how tiles are shown: actor, rotation, scale, mesh and minimap brush. Not part of ContentHash,
+	 * solvers do not depend on it.
+	 */
+	UPROPERTY()
+	uint64 VisualHash = 0;
+
+	UPROPERTY()
+	EYukiWaveFunctionCollapseTopology Topology = EYukiWaveFunctionCollapseTopology::Cube;
+
+	/**
+	 * Tile tags in index order.
+	 */
+	UPROPERTY()
+	TArray<FGameplayTag> TileTags;
+
+	/**
+	 * Tag to index lookup for TileTags.
+	 */
+	UPROPERTY()
+	TMap<FGameplayTag, int> TileIndices;
+
+	/**
+	 * Every tile tag, used to seed uncollapsed cells.
+	 */
+	UPROPERTY()
+	FGameplayTagContainer AllTags;
+
+	/**
+	 * Number of 64 bit words in a tile mask.
+	 */
+	UPROPERTY()
+	int NumWords = 0;
+
+	/**
+	 * Mask with a bit set for every tile.
+	 */
+	UPROPERTY()
+	TArray<uint64> AllMask;
+
+	/**
+	 * Laid out as [Direction][Tile][Word]. Tiles allowed in the neighbor at Direction when Tile is present.
+	 * Rows of directions the topology does not use are empty.
+	 */
+	UPROPERTY()
+	TArray<uint64> Propagator;
+
+	/**
+	 * Laid out as [Direction][Word]. Tiles allowed in cells touching the grid border at Direction, every tile
+	 * matching a border tag including child tags.
+	 */
+	UPROPERTY()
+	TArray<uint64> BorderMasks;
+
+	/**
+	 * Directions that have a border rule, as a bitfield of EYDWaveFunctionDirection.
+	 */
+	UPROPERTY()
+	uint32 BorderDirections = 0;
+
+	UPROPERTY()
+	TArray<float> Weights;
+
+	UPROPERTY()
+	TArray<int> MaxCounts;
+
+	/**
+	 * Walkable directions of every tile, as a bitfield of EYDWaveFunctionDirection.
+	 */
+	UPROPERTY()
+	TArray<uint32> WalkDirections;
+
+	/**
+	 * True if validation found neighbor rules that are missing or not mirrored.
+	 */
+	UPROPERTY()
+	bool bHasContradictions = false;
+
+	static constexpr uint8 MissingNeighbor = 1 << 0;
+	static constexpr uint8 UnmirroredRule = 1 << 1;
+
+	/**
+	 * Why each tile failed validation, MissingNeighbor and UnmirroredRule flags.
+	 */
+	UPROPERTY()
+	TArray<uint8> TileContradictions;
+
+	// Rebuilds the table from the model and validates its rules. If the tile set did not change only the
+	// rows of edited tiles are rebuilt and only the tiles they connect to are validated again.
+	void Compile(const UYukiWaveFunctionCollapseModel& Model);
+
+	// Returns a hash of every rule in the model that affects the compiled table.
+	static uint64 ComputeContentHash(const UYukiWaveFunctionCollapseModel& Model);
+	static uint64 ComputeTileSetHash(const UYukiWaveFunctionCollapseModel& Model, TConstArrayView<FGameplayTag> SortedTags);
+	static uint64 ComputeTileHash(const UYukiWaveFunctionCollapseModel& Model, const FGameplayTag& Tag);
+	static uint64 ComputeVisualHash(const UYukiWaveFunctionCollapseModel& Model, TConstArrayView<FGameplayTag> SortedTags);
+
+	bool IsCompiled() const { return ContentHash != 0; }
+	int NumTiles() const { return TileTags.Num(); }
+
+	// Returns the index of a tile, or INDEX_NONE if the tag is not a tile.
+	int GetTileIndex(const FGameplayTag& Tag) const
+	{
+		const int* Index = TileIndices.Find(Tag);
+		return Index ? *Index : INDEX_NONE;
+	}
+
+	const uint64* GetPropagatorRow(EYDWaveFunctionDirection Direction, int Tile) const
+	{
+		return Propagator.GetData() + ((int) Direction * NumTiles() + Tile) * NumWords;
+	}
+
+	const uint64* GetBorderMask(EYDWaveFunctionDirection Direction) const
+	{
+		return BorderMasks.GetData() + (int) Direction * NumWords;
+	}
+
+	bool HasBorder(EYDWaveFunctionDirection Direction) const
+	{
+		return (BorderDirections & (1u << (uint32) Direction)) != 0;
+	}
+
+	// Converts a tile mask into the tags it contains.
+	FGameplayTagContainer MaskToTags(const uint64* Mask) const;
+
+	// Converts tags into a tile mask, ignoring tags that are not tiles.
+	void TagsToMask(const FGameplayTagContainer& Tags, uint64* OutMask) const;
+
+	// Builds the mask of tiles whose tag matches Tag, including child tags, the same way FGameplayTagContainer::HasTag does.
+	void GetMatchingMask(const FGameplayTag& Tag, uint64* OutMask) const;
+
+private:
+	void RecompileTiles(const UYukiWaveFunctionCollapseModel& Model, TConstArrayView<int> ChangedTiles);
+	// Rebuilds the rows of a tile. Returns false if it names neighbors that are not tiles.
+	bool CompileTile(const UYukiWaveFunctionCollapseModel& Model, int Tile);
+	// Returns false and logs if a neighbor of the tile does not allow it back.
+	bool ValidateTile(int Tile) const;
+	void CompileBorders(const UYukiWaveFunctionCollapseModel& Model);
+	static uint64 CombineContentHash(const UYukiWaveFunctionCollapseModel& Model, uint64 InTileSetHash, TConstArrayView<uint64> InTileHashes);
+};
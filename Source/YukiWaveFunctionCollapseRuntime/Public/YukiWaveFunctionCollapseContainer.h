@@ -4,9 +4,16 @@
 
 #include "CoreMinimal.h"
 #include "YukiWaveFunctionCollapseModel.h"
+#include "YukiWaveFunctionCollapseNavGraph.h"
 #include "GameFramework/Actor.h"
+#include "UObject/ObjectKey.h"
 #include "YukiWaveFunctionCollapseContainer.generated.h"
 
+struct FMeshDescription;
+struct FYukiWaveFunctionCollapseMergeSource;
+class UStaticMeshComponent;
+class UYukiWaveFunctionCollapseStreamingSolver;
+
 UCLASS()
 class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API AYukiWaveFunctionCollapseContainer : public AActor
 {
@@ -17,12 +24,127 @@ public:
 	AYukiWaveFunctionCollapseContainer();
 
 	void ClearTiles();
+	// Spawns the tiles of a solver. Reuses the existing tiles when the model and size are unchanged.
 	void InitWithSolver(UYukiWaveFunctionCollapseSolver* Solver);
+	// Prepares for the tiles of a model and size, clearing them unless the model, its rules and tile visuals
+	// and the size are unchanged. Tile indices refer to InRules, the rules the model published last if null.
+	void InitForModel(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> InRules = nullptr);
+
+	// Only adds, removes or moves the tiles of cells that differ from the solver's current state.
+	UFUNCTION(BlueprintCallable)
+	void UpdateFromSolver(UYukiWaveFunctionCollapseSolver* Solver);
+
+	// Brings a single cell in line with the solver.
+	void UpdateCell(UYukiWaveFunctionCollapseSolver* Solver, int Cell);
+
+	// Shows a tile in a cell, INDEX_NONE clears it.
+	void SetCellTile(int Cell, int Tile);
+
+	// Spawns up to MaxCells cells published by a streaming solve, in the order they collapsed, and links them
+	// in the nav graph. Once the stream is finished the container is brought fully in line with its solver,
+	// once, later calls return right away.
+	UFUNCTION(BlueprintCallable)
+	void UpdateFromStream(UYukiWaveFunctionCollapseStreamingSolver* Stream, int32 MaxCells = 256);
 
 	UPROPERTY()
 	FIntVector Size;
 	UPROPERTY()
 	int CellSize;
 
-	TArray<TObjectPtr<UActorComponent>> Tiles;
+	// Returns the transform of the tile in a cell relative to the container, with the tile's rotation and scale.
+	FTransform GetCellTransform(int Cell, const FYukiWaveFunctionCollapseTileModel& TileModel) const;
+
+	// Merges the tiles of every chunk with changed cells on worker threads. The meshes are swapped in
+	// on the game thread once they are built.
+	void RebuildDirtyChunks();
+
+	// Drops every cached merged mesh.
+	static void EmptyMergedMeshCache();
+
+	/**
+	 * Draws tiles with a StaticMesh as one merged mesh per chunk instead of spawning their TileActor.
+	 * Meant for purely visual tiles on very large maps. Applies on the next InitWithSolver.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Merge")
+	bool bMergeStaticMeshes = false;
+
+	/**
+	 * Cells per merged chunk. Smaller chunks cull better and rebuild faster, larger chunks draw less.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Merge", meta = (ClampMin = 1, EditCondition = "bMergeStaticMeshes"))
+	FIntVector MergeChunkSize = FIntVector(8, 8, 1);
+
+	/**
+	 * Keeps a graph of the walkable cells, updated per changed cell, to find paths before the navmesh is built.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Navigation")
+	bool bBuildNavGraph = true;
+
+	/**
+	 * Marks the navmesh dirty around changed cells only, one area per MergeChunkSize chunk. For navigation
+	 * set to rebuild dirty areas instead of the whole container.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Navigation")
+	bool bDirtyNavigationFromCells = false;
+
+	// Fills OutPath with the world locations of the cells on the shortest walkable path between the cells
+	// closest to From and To. Returns false if there is no such path.
+	UFUNCTION(BlueprintCallable, Category = "Navigation")
+	bool FindNavPath(const FVector& From, const FVector& To, TArray<FVector>& OutPath) const;
+
+	const FYukiWaveFunctionCollapseNavGraph& GetNavGraph() const { return NavGraph; }
+
+protected:
+	bool IsMergedTile(int Tile) const;
+	FIntVector GetNumChunks() const;
+	int GetChunkIndex(int Cell) const;
+	FVector GetChunkOrigin(int Chunk) const;
+	TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> GetMergeSource(UStaticMesh* Mesh);
+	void OnChunkMerged(int Chunk, int Generation, uint64 Key, const FMeshDescription& MeshDescription, const TArray<UMaterialInterface*>& Materials);
+	void SetChunkMesh(int Chunk, UStaticMesh* Mesh);
+	void DirtyNavigation(TConstArrayView<int> Cells) const;
+
+	UPROPERTY()
+	TObjectPtr<UYukiWaveFunctionCollapseModel> Model;
+
+	// Rules CellTiles index into, the solver's table rather than the model's latest.
+	TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> Rules;
+	// Visual hash of the model the spawned tiles were built from.
+	uint64 VisualHash = 0;
+	// MergeChunkSize and bMergeStaticMeshes the chunks were laid out with, edits apply on the next init.
+	FIntVector ChunkSize = FIntVector(1, 1, 1);
+	bool bMergedTiles = false;
+
+	/**
+	 * Tile component of every cell, null for uncollapsed and empty cells.
+	 */
+	UPROPERTY()
+	TArray<TObjectPtr<UChildActorComponent>> CellComponents;
+
+	// Tile index shown in every cell, INDEX_NONE when uncollapsed.
+	TArray<int> CellTiles;
+
+	/**
+	 * Merged mesh component of every chunk, null for chunks without merged tiles.
+	 */
+	UPROPERTY()
+	TArray<TObjectPtr<UStaticMeshComponent>> ChunkComponents;
+
+	/**
+	 * Tile meshes read by merge jobs, kept alive until the container is cleared.
+	 */
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UStaticMesh>> MergeSourceMeshes;
+
+	TMap<TObjectKey<UStaticMesh>, TSharedPtr<const FYukiWaveFunctionCollapseMergeSource>> MergeSources;
+
+	// Merge job each chunk is waiting for, results of older jobs are dropped.
+	TArray<int> ChunkGenerations;
+	int MergeGeneration = 0;
+	TBitArray<> DirtyChunks;
+
+	FYukiWaveFunctionCollapseNavGraph NavGraph;
+
+	// Solver of the finished stream the container was last brought in line with.
+	TWeakObjectPtr<UYukiWaveFunctionCollapseSolver> SyncedStreamSolver;
 };
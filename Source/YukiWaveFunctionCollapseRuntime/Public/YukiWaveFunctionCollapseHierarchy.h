@@ -0,0 +1,143 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameplayTagContainer.h"
+#include "Engine/DataAsset.h"
+#include "YukiWaveFunctionCollapseHierarchy.generated.h"
+
+class UYukiWaveFunctionCollapseModel;
+class UYukiWaveFunctionCollapseSolver;
+
+/**
+ * UYukiWaveFunctionCollapseHierarchy
+ *
+ * Maps the tiles of a coarse layout model (districts, rooms) to the fine tiles allowed in the block of
+ * BlockSize fine cells under every coarse cell.
+ */
+UCLASS(BlueprintType)
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API UYukiWaveFunctionCollapseHierarchy : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	/**
+	 * Model solved first, one cell per block.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TObjectPtr<UYukiWaveFunctionCollapseModel> CoarseModel;
+
+	/**
+	 * Model of the final grid.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TObjectPtr<UYukiWaveFunctionCollapseModel> FineModel;
+
+	/**
+	 * Fine cells covered by one coarse cell.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FIntVector BlockSize = FIntVector(8, 8, 1);
+
+	/**
+	 * Fine tiles allowed under each coarse tile, matching child tags. Coarse tiles without an entry allow every fine tile.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TMap<FGameplayTag, FGameplayTagContainer> AllowedFineTiles;
+
+	// Builds the mask of fine tiles allowed under every coarse tile, NumWords of the fine rules per coarse tile.
+	void BuildFineMasks(TArray<uint64>& OutMasks);
+};
+
+/**
+ * UYukiWaveFunctionCollapseHierarchicalSolver
+ *
+ * Solves the coarse model of a hierarchy, then every block of fine cells under it as its own small solve.
+ * Blocks are solved in two checkerboard phases on worker threads: no two blocks of a phase touch, and the
+ * second phase is constrained by the tiles the first one placed on the shared faces, so blocks agree along
+ * their borders. The blocks are then stitched into one fine solver, re-solving any failed block in place.
+ */
+UCLASS(BlueprintType)
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API UYukiWaveFunctionCollapseHierarchicalSolver : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	UFUNCTION(BlueprintCallable)
+	void Init(UYukiWaveFunctionCollapseHierarchy* InHierarchy, FIntVector InCoarseSize, int32 InSeed);
+
+	// Returns true if every fine cell collapsed.
+	UFUNCTION(BlueprintCallable)
+	bool SolveFully();
+
+	UFUNCTION(BlueprintPure)
+	UYukiWaveFunctionCollapseSolver* GetCoarseSolver() const { return CoarseSolver; }
+
+	// Solver holding the full fine grid, valid after SolveFully.
+	UFUNCTION(BlueprintPure)
+	UYukiWaveFunctionCollapseSolver* GetFineSolver() const { return FineSolver; }
+
+	UFUNCTION(BlueprintPure)
+	FIntVector GetFineSize() const;
+
+	UFUNCTION(BlueprintPure)
+	int32 GetNumFailedBlocks() const { return NumFailedBlocks; }
+
+	/**
+	 * Seeds tried per block before it is left to the stitched solve.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxBlockAttempts = 4;
+
+	/**
+	 * Restarts of a block solve per attempt.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxBlockRestarts = 8;
+
+	/**
+	 * Backtracks allowed when re-solving a failed block inside the stitched grid.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxFallbackBacktracks = 1000;
+
+protected:
+	bool SolveBlocks();
+	// Fills the CellMasks of a block: the fine tiles of its coarse tile, limited on every face by the solved
+	// tiles of the neighboring block, or by what the neighbor's coarse tile could support if it is not solved.
+	void BuildBlockMasks(int Block, TArray<uint64>& OutMasks) const;
+	uint32 GetBlockBorders(int Block) const;
+	// First fine cell of a block, blocks are indexed like the coarse cells.
+	FIntVector GetBlockOrigin(int Block) const;
+	void StitchBlocks();
+
+	UPROPERTY()
+	TObjectPtr<UYukiWaveFunctionCollapseHierarchy> Hierarchy;
+
+	UPROPERTY()
+	TObjectPtr<UYukiWaveFunctionCollapseSolver> CoarseSolver;
+
+	UPROPERTY()
+	TObjectPtr<UYukiWaveFunctionCollapseSolver> FineSolver;
+
+	UPROPERTY()
+	TArray<TObjectPtr<UYukiWaveFunctionCollapseSolver>> BlockSolvers;
+
+	FIntVector CoarseSize;
+	int32 Seed = 0;
+
+	// Fine rules every block is solved with, tile indices in FineMasks and BlockTiles refer to them.
+	TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> FineRules;
+
+	// Fine tiles allowed under every coarse tile.
+	TArray<uint64> FineMasks;
+	// Fine tiles some tile of FineMasks allows next to it, per coarse tile and direction.
+	TArray<uint64> SupportMasks;
+
+	// Collapsed tile of every fine cell, INDEX_NONE until its block is solved.
+	TArray<int> BlockTiles;
+	// Written by the block workers, so one bool per block rather than packed bits.
+	TArray<bool> SolvedBlocks;
+	int32 NumFailedBlocks = 0;
+};
@@ -0,0 +1,56 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FMeshDescription;
+class UMaterialInterface;
+class UStaticMesh;
+
+/**
+ * LOD0 geometry of a tile StaticMesh copied out of its render data, so chunks can be merged on worker
+ * threads without touching UObjects. Cooked builds need bAllowCPUAccess on the source meshes.
+ */
+struct FYukiWaveFunctionCollapseMergeSource
+{
+	struct FSection
+	{
+		// Only used as a key on workers, never dereferenced off the game thread.
+		UMaterialInterface* Material = nullptr;
+		int FirstIndex = 0;
+		int NumTriangles = 0;
+	};
+
+	TArray<FVector3f> Positions;
+	TArray<FVector3f> Normals;
+	TArray<FVector3f> Tangents;
+	TArray<float> BinormalSigns;
+	TArray<FVector2f> UVs;
+	TArray<uint32> Indices;
+	TArray<FSection> Sections;
+
+	// Returns null and logs if the mesh has no CPU readable LOD0.
+	static TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> Create(UStaticMesh& Mesh);
+};
+
+/**
+ * Tiles of one chunk in cell order, with transforms relative to the chunk origin.
+ */
+struct FYukiWaveFunctionCollapseMergeChunk
+{
+	struct FInstance
+	{
+		TSharedPtr<const FYukiWaveFunctionCollapseMergeSource> Source;
+		FTransform Transform;
+	};
+
+	TArray<FInstance> Instances;
+
+	// Material of every polygon group of the merged mesh, in order of first use.
+	TArray<UMaterialInterface*> Materials;
+
+	// Merges the instances into a mesh with one polygon group per material. Thread safe.
+	// The result only depends on the order of Instances, so equal chunks produce equal meshes.
+	void Build(FMeshDescription& OutMesh);
+};
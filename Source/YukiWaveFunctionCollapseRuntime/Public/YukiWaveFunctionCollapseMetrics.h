@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameplayTagContainer.h"
+#include "YukiWaveFunctionCollapseMetrics.generated.h"
+
+class UYukiWaveFunctionCollapseSolver;
+
+/**
+ * Selects which statistics FYukiWaveFunctionCollapseMetrics::Compute gathers.
+ */
+USTRUCT(BlueprintType)
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseMetricsSettings
+{
+	GENERATED_BODY()
+
+public:
+	/**
+	 * Count the cells collapsed to every tile.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bTileHistogram = true;
+
+	/**
+	 * Desired share of each tag. Weights are normalized, tiles match their parent tags.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TMap<FGameplayTag, float> TargetHistogram;
+
+	/**
+	 * Group walkable cells into connected regions, ignoring walk direction.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	bool bRegions = true;
+
+	/**
+	 * Shortest walking path from the first StartMarker cell to the closest EndMarker cell.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FGameplayTag StartMarker;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FGameplayTag EndMarker;
+
+	/**
+	 * Minimum number of cells per tag. Also usable as solver requirements to reject solves early.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TMap<FGameplayTag, int32> MinCounts;
+};
+
+/**
+ * Statistics of a solved grid, gathered in one pass over the cells.
+ */
+USTRUCT(BlueprintType)
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseMetrics
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TMap<FGameplayTag, int32> TileCounts;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 UncollapsedCells = 0;
+
+	/**
+	 * Total variation distance between the tag shares and TargetHistogram, 0 is a perfect match, 1 disjoint.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float HistogramError = 0.0f;
+
+	/**
+	 * Cells whose tile has any WalkDirections.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 WalkableCells = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	float WalkableCoverage = 0.0f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 NumRegions = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 LargestRegion = 0;
+
+	/**
+	 * Steps between the markers, -1 if a marker is missing or unreachable.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 PathLength = -1;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	bool bMeetsMinCounts = true;
+
+	static FYukiWaveFunctionCollapseMetrics Compute(const UYukiWaveFunctionCollapseSolver& Solver, const FYukiWaveFunctionCollapseMetricsSettings& Settings);
+};
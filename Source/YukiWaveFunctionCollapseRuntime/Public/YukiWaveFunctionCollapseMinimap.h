@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Object.h"
+#include "YukiWaveFunctionCollapseMinimap.generated.h"
+
+class UTexture2D;
+class UYukiWaveFunctionCollapseModel;
+class UYukiWaveFunctionCollapseSolver;
+
+/**
+ * BrushSize x BrushSize pixels of every tile's BrushTexture, already rotated by the tile's yaw.
+ * Built once per (rules, brushes, brush size) and shared read-only between minimaps.
+ */
+struct FYukiWaveFunctionCollapseBrushAtlas
+{
+	int BrushSize = 0;
+	TArray<FColor> Pixels;
+	// Tiles without a readable BrushTexture are drawn with the background color.
+	TBitArray<> HasBrush;
+
+	const FColor* GetBrush(int Tile) const { return Pixels.GetData() + Tile * BrushSize * BrushSize; }
+};
+
+/**
+ * UYukiWaveFunctionCollapseMinimap
+ *
+ * Draws the tile brushes of a solver on the CPU, one BGRA8 texture per Z layer with every cell covering
+ * BrushSize x BrushSize pixels. Does not touch the RHI while blitting, so it also runs on servers and
+ * commandlets to produce map thumbnails; textures are only uploaded when the process can render.
+ */
+UCLASS(BlueprintType)
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API UYukiWaveFunctionCollapseMinimap : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	// Draws every cell of the solver. Reallocates the layers if the model or size changed.
+	UFUNCTION(BlueprintCallable)
+	void Build(UYukiWaveFunctionCollapseSolver* Solver);
+
+	// Redraws the cells whose collapsed tile changed since the last Build or Update.
+	UFUNCTION(BlueprintCallable)
+	void UpdateFromSolver(UYukiWaveFunctionCollapseSolver* Solver);
+
+	// Redraws specific cells, for callers that already track dirty cells.
+	void UpdateCells(const UYukiWaveFunctionCollapseSolver& Solver, TConstArrayView<int> Cells);
+
+	UFUNCTION(BlueprintPure)
+	UTexture2D* GetLayerTexture(int32 Z) const;
+
+	// CPU copy of a layer, LayerWidth x LayerHeight pixels.
+	TConstArrayView<FColor> GetLayerPixels(int32 Z) const { return Layers[Z]; }
+
+	// Layers keep the brush size they were built with until the next Build.
+	int32 GetLayerWidth() const { return Atlas ? Size.X * Atlas->BrushSize : 0; }
+	int32 GetLayerHeight() const { return Atlas ? Size.Y * Atlas->BrushSize : 0; }
+
+	// Drops every cached brush atlas.
+	static void EmptyAtlasCache();
+
+	/**
+	 * Pixels per cell edge. Brushes are resampled to this size. Changes apply on the next Build or UpdateFromSolver.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1, ClampMax = 256))
+	int32 BrushSize = 16;
+
+	/**
+	 * Color of uncollapsed cells and tiles without a BrushTexture.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	FColor BackgroundColor = FColor::Black;
+
+protected:
+	void BlitCells(TConstArrayView<int> Cells);
+	void UploadDirtyLayers();
+
+	// Returns the brushes of the tiles of InRules, in their index order, shared by every minimap drawing them.
+	static TSharedPtr<const FYukiWaveFunctionCollapseBrushAtlas> GetAtlas(UYukiWaveFunctionCollapseModel& Model, const TSharedRef<const FYukiWaveFunctionCollapseCompiledModel>& InRules, int InBrushSize);
+	// Reads a brush into BrushSize x BrushSize pixels rotated by Quarters * 90 degrees. False if the texture has no CPU readable data.
+	static bool ReadBrush(UTexture2D& Texture, int InBrushSize, int Quarters, FColor* OutPixels);
+
+	UPROPERTY(Transient)
+	TObjectPtr<UYukiWaveFunctionCollapseModel> Model;
+
+	UPROPERTY(Transient)
+	TArray<TObjectPtr<UTexture2D>> LayerTextures;
+
+	FIntVector Size = FIntVector::ZeroValue;
+	uint64 RulesHash = 0;
+	// Visual hash of the model the atlas was taken for, brush or rotation edits pick a new atlas.
+	uint64 VisualHash = 0;
+	TSharedPtr<const FYukiWaveFunctionCollapseBrushAtlas> Atlas;
+
+	TArray<TArray<FColor>> Layers;
+	TBitArray<> DirtyLayers;
+
+	// Tile index drawn in every cell, INDEX_NONE when uncollapsed.
+	TArray<int> CellTiles;
+};
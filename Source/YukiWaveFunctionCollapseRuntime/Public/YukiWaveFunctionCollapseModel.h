@@ -6,27 +6,23 @@
 #include "GameplayTagContainer.h"
 #include "NativeGameplayTags.h"
 #include "Engine/DataAsset.h"
+#include "YukiWaveFunctionCollapseCompiledModel.h"
+#include "YukiWaveFunctionCollapseStats.h"
+#include "YukiWaveFunctionCollapseTopology.h"
+#include "YukiWaveFunctionCollapseWave.h"
 #include "YukiWaveFunctionCollapseModel.generated.h"
 
+class UStaticMesh;
+
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_Border);
 UE_DECLARE_GAMEPLAY_TAG_EXTERN(TAG_Empty);
 
-/**
- * EYDWaveFunctionDirection
- *
- * Direction of the adjacency rule. 
- */
-UENUM(BlueprintType)
-enum class EYDWaveFunctionDirection
-{
-	XPlus UMETA(DisplayName = "X+ Right"),
-	XMinus UMETA(DisplayName = "X- Left"),
-	YPlus UMETA(DisplayName = "Y+ Forward"),
-	YMinus UMETA(DisplayName = "Y- Back"),
-	ZPlus UMETA(DisplayName = "Z+ Up"),
-	ZMinus UMETA(DisplayName = "Z- Down"),
-	MAX UMETA(Hidden)
-};
+class UYukiWaveFunctionCollapseModel;
+DECLARE_MULTICAST_DELEGATE_OneParam(FOnYukiWaveFunctionCollapseRulesChanged, UYukiWaveFunctionCollapseModel*);
+
+// Returns a Neighboring cell of a Cube grid given an index and a direction. Will return false if the index is at a boundary of that direction.
+YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API bool GetNeighborCell(FIntVector Size, int Index, EYDWaveFunctionDirection Direction, int& OutNeighborIndex);
+YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API EYDWaveFunctionDirection GetOppositeDirection(EYDWaveFunctionDirection Direction);
 
 USTRUCT(BlueprintType)
 struct FYukiWaveFunctionCollapseTileModel
@@ -71,6 +67,12 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	TSoftObjectPtr<UTexture2D> BrushTexture;
 
+	/**
+	 * Optional static mesh standing in for TileActor when rendering with instanced meshes.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	TSoftObjectPtr<UStaticMesh> StaticMesh;
+
 	/**
 	 * Neighbor Options. Determines compatibility with other tags in specific directions.
 	 */
@@ -131,9 +133,35 @@ public:
 	TMap<EYDWaveFunctionDirection, FGameplayTagContainer> Borders;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	int CellSize;
+	/**
+	 * Shape of the grid. Hex prisms also use the HexNorthWest and HexSouthEast directions.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	EYukiWaveFunctionCollapseTopology Topology = EYukiWaveFunctionCollapseTopology::Cube;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Instanced)
 	TArray<TObjectPtr<UYukiWaveFunctionCollapseSolverDecorator>> Decorators;
 
+	virtual void PostLoad() override;
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+	virtual void PostEditUndo() override;
+#endif
+
+	// Returns the compiled rule table, compiling it first if it is missing. Game thread only, the reference is
+	// only valid until the rules are compiled again, hold GetSharedCompiledModel to keep a table.
+	const FYukiWaveFunctionCollapseCompiledModel& GetCompiledModel();
+
+	// Returns the published rule table, compiling it first if it is missing. Published tables never change,
+	// compiling publishes a new one, so solvers can keep reading theirs on any thread while the model is
+	// edited. Game thread only.
+	TSharedRef<const FYukiWaveFunctionCollapseCompiledModel> GetSharedCompiledModel();
+
+	// Rebuilds and validates the compiled rule table, broadcasting OnRulesChanged if it changed. Returns false if the rules have contradictions.
+	bool CompileRules();
+
+	// Broadcast after the compiled rules changed, so running solvers can pick them up.
+	FOnYukiWaveFunctionCollapseRulesChanged OnRulesChanged;
+
 #if WITH_EDITORONLY_DATA
 	/**
 	 * Fixes any contradictions found, will replicate patterns in the opposite direction.
@@ -141,6 +169,19 @@ public:
 	UFUNCTION(CallInEditor)
 	void SolveContradictions();
 #endif
+
+protected:
+	// Publishes a copy of CompiledModel for solvers. Cooked builds never save, so it is moved instead.
+	void PublishCompiledModel();
+
+	/**
+	 * Dense rule table built from Tiles and Borders when the asset is saved or cooked. Compiled in place on
+	 * the game thread, solvers only see the copies published in PublishedModel.
+	 */
+	UPROPERTY()
+	FYukiWaveFunctionCollapseCompiledModel CompiledModel;
+
+	TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> PublishedModel;
 };
 
 USTRUCT(BlueprintType)
@@ -164,9 +205,22 @@ class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API UYukiWaveFunctionCollapseSolver : publ
 public:
 	UYukiWaveFunctionCollapseSolver();
 
+	virtual void BeginDestroy() override;
+
 	UFUNCTION(BlueprintCallable)
 	void Init(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, FRandomStream InRandom);
 
+	// Restores the post-border state of the current model and size for another solve with a new seed.
+	// Much cheaper than Init, the initial state is shared between every solver of the same model and size.
+	UFUNCTION(BlueprintCallable)
+	void Reset(int32 Seed);
+
+	// Starts a solve of part of a larger grid, bypassing the shared initial state. The model borders are only
+	// applied on the sides set in BorderDirections (one bit per EYDWaveFunctionDirection), and every cell is
+	// limited to its NumWords words of CellMasks if given. Solves with InRules, or the model's published rules
+	// if null. Safe off the game thread when InRules is given.
+	void InitConstrained(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, int32 Seed, uint32 BorderDirections, TConstArrayView<uint64> CellMasks, TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> InRules = nullptr);
+
 	void CheckContradictions();
 	UFUNCTION(BlueprintCallable)
 	// Continues to do a SingleIteration until solving is finished.
@@ -176,12 +230,6 @@ public:
 	// Does a single iteration of solving.
 	void SingleIteration();
 
-	/**
-	 * Current state of cells.
-	 */
-	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
-	TArray<FYukiWaveFunctionCollapseCell> Cells;
-
 	/**
 	 * Model that will be solved.
 	 */
@@ -194,6 +242,24 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	FIntVector Size;
 
+	/**
+	 * Restarts SolveFully may do after contradictions before giving up, -1 for infinite.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxRestarts = -1;
+
+	// Returns a copy of the current state of cells.
+	UFUNCTION(BlueprintCallable)
+	TArray<FYukiWaveFunctionCollapseCell> GetCells() const;
+
+	// Returns the tag every cell collapsed to, empty for cells that are not collapsed. Stands in for the
+	// Cells property, which was replaced by the wave and can no longer be read directly.
+	UFUNCTION(BlueprintCallable, BlueprintPure, meta = (DeprecatedFunction, DeprecationMessage = "The Cells property was removed, use GetCells, GetCollapsedTag or GetCellsByTag instead."))
+	TArray<FGameplayTag> GetCollapsedTags() const;
+
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	int NumCells() const { return Wave.Num(); }
+
 	// Returns Cells that contain a tag.
 	UFUNCTION(BlueprintCallable)
 	TArray<int> GetCellsByTag(const FGameplayTag& Tag) const;
@@ -206,10 +272,20 @@ public:
 
 	UFUNCTION(BlueprintCallable)
 	bool RemoveTag(int Index, const FGameplayTag& Tag);
+	// Limits a cell to the tiles in Tags and propagates the change. Returns false on a contradiction.
+	UFUNCTION(BlueprintCallable)
+	bool RestrictCell(int Index, const FGameplayTagContainer& Tags);
 	// Remove and optionally collapse all cells that contain the given tag.
 	UFUNCTION(BlueprintCallable)
 	void RemoveTagFromUncollapsedCells(const FGameplayTag& Tag);
 
+	// Regenerates the cells in [Min, Max) and keeps the rest of the grid. The region is reset to every option,
+	// constrained by the cells around it and solved with backtracking that never leaves the region, so the
+	// cost scales with the region, not the grid. Returns false and leaves the region unchanged if no solution
+	// was found within MaxBacktracks.
+	UFUNCTION(BlueprintCallable)
+	bool ResolveRegion(FIntVector Min, FIntVector Max, int32 Seed, int32 MaxBacktracks = 1000);
+
 	// Returns the distance between two cells by their index.
 	UFUNCTION(BlueprintCallable)
 	float CellHorizontalDistanceSquared(int IndexA, int IndexB) const;
@@ -223,32 +299,194 @@ public:
 	UFUNCTION(BlueprintCallable)
 	bool IsCellCollapsed(int Index) const;
 
+	// Returns the tile index a cell collapsed to, or INDEX_NONE if it is not collapsed.
+	int GetCollapsedTileIndex(int Index) const;
+
+	// Returns the tag a cell collapsed to, or an empty tag if it is not collapsed.
+	UFUNCTION(BlueprintCallable)
+	FGameplayTag GetCollapsedTag(int Index) const;
+
 	UFUNCTION(BlueprintCallable)
 	TArray<int> GetWalkableNeighbors(int Index) const;
 
 	UFUNCTION(BlueprintCallable)
 	int CountCellsWithTag(const FGameplayTag& Tag) const;
 
+	// Returns the collapsed cells with a tile matching Tag within Radius cells of Center, sorted by index.
+	UFUNCTION(BlueprintCallable)
+	TArray<int> GetCellsByTagInRadius(const FGameplayTag& Tag, int Center, float Radius) const;
+
+	// Cells collapsed to a tile, read in place from the solver's index. Unordered and only valid until the
+	// solver changes.
+	TConstArrayView<int> GetCellsCollapsedTo(int Tile) const { return CollapsedCells.GetCells(Tile); }
+
+	// Calls Func(Tile) for every tile matching Tag, including child tags.
+	template <typename FuncType>
+	void ForEachMatchingTile(const FGameplayTag& Tag, FuncType&& Func) const
+	{
+		for (int Tile = 0; Tile < Rules->NumTiles(); Tile++)
+		{
+			if (Rules->TileTags[Tile].MatchesTag(Tag))
+			{
+				Func(Tile);
+			}
+		}
+	}
+
+	// Calls Func(Cell) for every cell collapsed to a tile matching Tag, without scanning the grid.
+	template <typename FuncType>
+	void ForEachCollapsedCell(const FGameplayTag& Tag, FuncType&& Func) const
+	{
+		ForEachMatchingTile(Tag, [&](int Tile)
+		{
+			for (const int Cell : CollapsedCells.GetCells(Tile))
+			{
+				Func(Cell);
+			}
+		});
+	}
+
 	UFUNCTION(BlueprintCallable)
 	FGameplayTagContainer GetTagsForIndex(int Index) const;
 
 	UFUNCTION(BlueprintCallable)
 	void RemoveTagsFromUncollapsed(const FGameplayTagContainer& Tags);
 
-protected:
+	// Returns the counters and phase timings recorded since the last Init.
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	FYukiWaveFunctionCollapseSolveStats GetSolveStats() const { return SolveStats; }
+
+	// Makes SolveFully give up as soon as fewer than MinCount cells can still become a tag, for pipelines
+	// that reject candidates anyway. Kept across Init and Reset.
+	UFUNCTION(BlueprintCallable)
+	void SetRequirements(const TMap<FGameplayTag, int32>& MinCounts);
+
+	// Collapses cells close to Cell first: the next cell is the one with the fewest options plus Bias per cell
+	// of distance to Cell, so streamed results near a player are final early. INDEX_NONE clears it. Kept
+	// across Reset, cleared by Init.
+	UFUNCTION(BlueprintCallable)
+	void SetFocus(int32 Cell, float Bias = 1.0f);
+
+	// Returns true if the last SolveFully stopped because a requirement could no longer be met.
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	bool IsRejected() const { return bRejected; }
+
+	// Returns true if a cell ran out of options.
+	UFUNCTION(BlueprintCallable, BlueprintPure)
+	bool HasContradiction() const { return bContradiction; }
+
+	const FYukiWaveFunctionCollapseWave& GetWave() const { return Wave; }
+	const FYukiWaveFunctionCollapseCompiledModel& GetRules() const { check(Rules); return *Rules; }
+	TSharedRef<const FYukiWaveFunctionCollapseCompiledModel> GetSharedRules() const { check(Rules); return Rules.ToSharedRef(); }
+
 	// Returns true if the solver is solved.
 	UFUNCTION(BlueprintCallable, BlueprintPure)
 	bool IsSolved() const;
 
+	// Moves the cells whose options changed since the last call into OutCells. bOutAllDirty is set
+	// instead when the whole wave was replaced, by Init or Reset.
+	void ConsumeDirtyCells(TArray<int>& OutCells, bool& bOutAllDirty);
+
+	// Switches to the rules Model published last, the solver keeps its own table until then. While the tile set
+	// is unchanged, collapsed cells that still agree with their collapsed neighbors and the borders are kept and
+	// the rest of the grid is propagated again. Returns false if the solver had to restart from the initial state.
+	UFUNCTION(BlueprintCallable)
+	bool RefreshRules();
+
+protected:
+	// Restores the shared post-border state for the current model and size, building it on first use.
+	void InitCells();
+	// Fills the wave with every option, applies the model borders on BorderDirections and the optional per-cell masks.
+	void BuildInitialState(uint32 BorderDirections = MAX_uint32, TConstArrayView<uint64> CellMasks = TConstArrayView<uint64>());
+	TSharedRef<const FYukiWaveFunctionCollapseInitialState> MakeInitialState() const;
+	void UpdateMemoryStats();
+
 	int GetMinimumEntropyCellIndex() const;
 	void CollapseAt(int Index);
+	void CollapseTo(int Index, int Tile);
 	void PropagateFrom(int Index);
-
-	FGameplayTag SelectTag(int Index) const;
-	TArray<TTuple<EYDWaveFunctionDirection, int>> ValidDirections(int Index) const;
-	FGameplayTagContainer GetValidNeighbors(int Index, EYDWaveFunctionDirection Direction);
+	// Propagates from every source cell, never changing cells outside [RegionMin, RegionMax).
+	void Propagate(TConstArrayView<int> Sources, const FIntVector& RegionMin, const FIntVector& RegionMax);
+	// Propagate with the neighbor iteration of one topology policy, see YukiWaveFunctionCollapseTopology.h.
+	template <typename TopologyType>
+	void Propagate(TConstArrayView<int> Sources, const FIntVector& RegionMin, const FIntVector& RegionMax);
+	// Builds the mask of tiles the options of a cell allow in its neighbor at Direction.
+	void GetAllowedNeighbors(int Index, EYDWaveFunctionDirection Direction, uint64* OutMask) const;
+	bool IsCellInRegion(int Index, const FIntVector& Min, const FIntVector& Max) const;
+
+	// Remembers the options of a cell before they change, while bRecordTrail is set.
+	void RecordTrail(int Index);
+	// Restores every cell recorded since the trail had TrailStart entries, newest first, and drops those entries.
+	void UnwindTrail(int TrailStart);
+
+	// Removes every option of a cell not in Mask and keeps the collapsed counts in sync. Returns the number removed.
+	int ConstrainCell(int Index, const uint64* Mask);
+	// Replaces the options of a cell and keeps the collapsed counts in sync.
+	void SetCellMask(int Index, const uint64* Mask);
+	// Updates the collapsed counts after a cell's options went from PrevCount (collapsed to PrevTile) to its current options.
+	void OnCellChanged(int Index, int PrevCount, int PrevTile);
+	void UpdateExhausted(int Tile);
+	// Recounts the cells that can still satisfy every requirement.
+	void InitRequirements();
+	bool CanMeetRequirements() const;
+
+	// Answers a cell query from the tile index once every cell collapsed. Returns the cells of every tile in Mask, sorted.
+	TArray<int> GetCollapsedCellsByMask(const uint64* Mask) const;
+
+	int SelectTile(int Index) const;
 	TArray<EYDWaveFunctionDirection> ValidBorders(int Index) const;
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	FRandomStream Random;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	FYukiWaveFunctionCollapseSolveStats SolveStats;
+
+	// Compiled rules of Model the wave was built with. Only replaced by Init and RefreshRules, so workers can
+	// read it while the model is recompiled.
+	TSharedPtr<const FYukiWaveFunctionCollapseCompiledModel> Rules;
+
+	// Current state of cells.
+	FYukiWaveFunctionCollapseWave Wave;
+
+	// Cells collapsed to each tile.
+	FYukiWaveFunctionCollapseTileIndex CollapsedCells;
+	// Tiles that reached their MaxCount.
+	TArray<uint64> ExhaustedMask;
+	int NumCollapsedCells = 0;
+	bool bContradiction = false;
+
+	// Propagation worklist, kept between calls to avoid reallocating.
+	TArray<int> Worklist;
+	TBitArray<> InWorklist;
+
+	// Cells in the order they changed during ResolveRegion, with their NumWords words of options before the
+	// change in TrailMasks. Undoing a decision only touches the cells it changed.
+	TArray<int> TrailCells;
+	TArray<uint64> TrailMasks;
+	bool bRecordTrail = false;
+
+	// Cells changed since the last ConsumeDirtyCells.
+	TArray<int> DirtyCells;
+	TBitArray<> DirtyMask;
+	bool bAllDirty = true;
+
+	struct FRequirement
+	{
+		FGameplayTag Tag;
+		int MinCount = 0;
+		TArray<uint64> Mask;
+		// Cells that can still become Tag.
+		TBitArray<> Possible;
+		int NumPossible = 0;
+	};
+	TArray<FRequirement> Requirements;
+	bool bRejected = false;
+
+	// Bias times the distance of every cell to the focus cell, empty without a focus.
+	TArray<float> FocusCosts;
+
+	TSharedPtr<const FYukiWaveFunctionCollapseInitialState> InitialState;
+	uint64 InitialStateHash = 0;
+	FIntVector InitialStateSize = FIntVector::ZeroValue;
 };
@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "YukiWaveFunctionCollapseTopology.h"
+
+class UYukiWaveFunctionCollapseSolver;
+struct FYukiWaveFunctionCollapseCompiledModel;
+
+/**
+ * FYukiWaveFunctionCollapseNavGraph
+ *
+ * Walkable links between the cells of a solved grid, built from the WalkDirections of the collapsed tiles.
+ * A cell links to a neighbor when its tile walks in that direction and the neighbor is collapsed, the same
+ * rule as UYukiWaveFunctionCollapseSolver::GetWalkableNeighbors. Cheap enough to answer path queries while
+ * the navmesh of the spawned tiles is still building, and updated per changed cell afterwards.
+ */
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseNavGraph
+{
+public:
+	// Links every cell of the solver.
+	void Build(const UYukiWaveFunctionCollapseSolver& Solver);
+
+	// Relinks the cells whose tile changed since the last Build or Update and their neighbors, building the
+	// graph if the grid changed shape. Cells whose links changed are added to OutChangedCells if given.
+	// Returns the number of cells whose tile changed.
+	int Update(const UYukiWaveFunctionCollapseSolver& Solver, TArray<int>* OutChangedCells = nullptr);
+
+	// Same as Update for only the given cells, with tiles from InCellTiles instead of the solver's wave, so it
+	// is safe while a worker is still solving. InCellTiles holds the tile of every cell of a grid of InSize.
+	int UpdateCells(const FYukiWaveFunctionCollapseCompiledModel& Rules, FIntVector InSize, TConstArrayView<int> InCellTiles, TConstArrayView<int> Cells, TArray<int>* OutChangedCells = nullptr);
+
+	void Reset();
+
+	int Num() const { return Links.Num(); }
+
+	bool IsLinked(int Cell, EYDWaveFunctionDirection Direction) const { return (Links[Cell] & (1u << (uint32) Direction)) != 0; }
+
+	// Directions a cell links to, one bit per EYDWaveFunctionDirection.
+	uint32 GetLinks(int Cell) const { return Links[Cell]; }
+
+	// Fills OutPath with the cells from From to To, both included, over the fewest links. Returns false if To
+	// is not reachable.
+	bool FindPath(int From, int To, TArray<int>& OutPath) const;
+
+	// Returns the cell whose center is closest to a location in cell units, see GetCellLocation.
+	int FindNearestCell(const FVector& Location) const;
+
+	EYukiWaveFunctionCollapseTopology GetTopology() const { return Topology; }
+	FIntVector GetSize() const { return Size; }
+
+protected:
+	// Starts over with every cell unlinked if the grid or its rules changed. CellTiles is left to fill.
+	bool Resize(const FYukiWaveFunctionCollapseCompiledModel& Rules, FIntVector InSize);
+	// Relinks cells whose tile changed and their neighbors.
+	void RelinkCells(const FYukiWaveFunctionCollapseCompiledModel& Rules, TConstArrayView<int> ChangedTiles, TArray<int>* OutChangedCells);
+	void LinkCell(const FYukiWaveFunctionCollapseCompiledModel& Rules, int Cell, TArray<int>* OutChangedCells);
+
+	EYukiWaveFunctionCollapseTopology Topology = EYukiWaveFunctionCollapseTopology::Cube;
+	FIntVector Size = FIntVector::ZeroValue;
+	// Content hash of the rules CellTiles index into.
+	uint64 RulesHash = 0;
+
+	// Tile of every cell when it was linked, INDEX_NONE when uncollapsed.
+	TArray<int> CellTiles;
+	TArray<uint32> Links;
+};
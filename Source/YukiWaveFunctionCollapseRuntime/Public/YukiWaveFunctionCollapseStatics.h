@@ -3,6 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "YukiWaveFunctionCollapseMetrics.h"
 #include "YukiWaveFunctionCollapseModel.h"
 #include "UObject/Object.h"
 #include "YukiWaveFunctionCollapseStatics.generated.h"
@@ -21,4 +22,8 @@ public:
 
 	UFUNCTION(BlueprintCallable, Category = "WaveFunctionCollapse", meta = (WorldContext = "WorldContextObject"))
 	static AActor* SpawnActorFromSolver(UObject* WorldContextObject, UYukiWaveFunctionCollapseSolver* Solver);
+
+	// Gathers the statistics selected in Settings in a single pass over the solved cells.
+	UFUNCTION(BlueprintCallable, Category = "WaveFunctionCollapse")
+	static FYukiWaveFunctionCollapseMetrics ComputeSolveMetrics(UYukiWaveFunctionCollapseSolver* Solver, const FYukiWaveFunctionCollapseMetricsSettings& Settings);
 };
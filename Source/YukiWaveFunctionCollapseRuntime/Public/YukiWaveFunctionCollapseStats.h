@@ -0,0 +1,142 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "YukiWaveFunctionCollapseStats.generated.h"
+
+// Solver instrumentation is compiled out of shipping builds.
+#ifndef YUKI_WFC_STATS
+#define YUKI_WFC_STATS !UE_BUILD_SHIPPING
+#endif
+
+DECLARE_STATS_GROUP(TEXT("YukiWaveFunctionCollapse"), STATGROUP_YukiWFC, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Init"), STAT_YukiWFC_Init, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Select"), STAT_YukiWFC_Select, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Collapse"), STAT_YukiWFC_Collapse, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Propagate"), STAT_YukiWFC_Propagate, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Iterations"), STAT_YukiWFC_Iterations, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Collapses"), STAT_YukiWFC_Collapses, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Propagation Pops"), STAT_YukiWFC_PropagationPops, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Eliminations"), STAT_YukiWFC_Eliminations, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Contradictions"), STAT_YukiWFC_Contradictions, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Restarts"), STAT_YukiWFC_Restarts, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Backtracks"), STAT_YukiWFC_Backtracks, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Wave Memory"), STAT_YukiWFC_BytesAllocated, STATGROUP_YukiWFC, YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API);
+
+/**
+ * Counters and phase timings recorded for a single solve. Reset on every Init.
+ * Stays zeroed in builds where YUKI_WFC_STATS is disabled.
+ */
+USTRUCT(BlueprintType)
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseSolveStats
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int Iterations = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int Collapses = 0;
+
+	/**
+	 * Number of cells popped from the propagation worklist.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int PropagationPops = 0;
+
+	/**
+	 * Number of options removed from cells by propagation.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int Eliminations = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int Contradictions = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int Restarts = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int Backtracks = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int PeakWorklistSize = 0;
+
+	/**
+	 * Bytes held by the solver's cell state.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 BytesAllocated = 0;
+
+	/**
+	 * Highest BytesAllocated of the solve, including restarts.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int64 PeakBytesAllocated = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	double InitSeconds = 0.0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	double SelectSeconds = 0.0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	double CollapseSeconds = 0.0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	double PropagateSeconds = 0.0;
+
+	FString ToString() const;
+};
+
+#if YUKI_WFC_STATS
+
+// Accumulates the lifetime of the scope into a seconds counter of FYukiWaveFunctionCollapseSolveStats.
+struct FYukiWaveFunctionCollapseScopedPhaseTimer
+{
+	explicit FYukiWaveFunctionCollapseScopedPhaseTimer(double& InSeconds)
+		: Seconds(InSeconds)
+		, StartCycles(FPlatformTime::Cycles64())
+	{
+	}
+
+	~FYukiWaveFunctionCollapseScopedPhaseTimer()
+	{
+		Seconds += FPlatformTime::ToSeconds64(FPlatformTime::Cycles64() - StartCycles);
+	}
+
+private:
+	double& Seconds;
+	uint64 StartCycles;
+};
+
+// Times a solver phase into the stat group, Unreal Insights and the per-solve stats struct.
+#define YUKI_WFC_SCOPE(Phase, Stats) \
+	SCOPE_CYCLE_COUNTER(STAT_YukiWFC_##Phase); \
+	TRACE_CPUPROFILER_EVENT_SCOPE(YukiWFC_##Phase); \
+	FYukiWaveFunctionCollapseScopedPhaseTimer ANONYMOUS_VARIABLE(YukiWFCPhase_)((Stats).Phase##Seconds)
+
+// Increments a counter in both the stat group and the per-solve stats struct.
+#define YUKI_WFC_INC(Counter, Stats, Amount) \
+	do { (Stats).Counter += (Amount); INC_DWORD_STAT_BY(STAT_YukiWFC_##Counter, (Amount)); } while (0)
+
+#define YUKI_WFC_PEAK(Counter, Stats, Value) \
+	do { (Stats).Counter = FMath::Max((Stats).Counter, (Value)); } while (0)
+
+#define YUKI_WFC_SET_MEMORY(Stats, Bytes) \
+	do { DEC_MEMORY_STAT_BY(STAT_YukiWFC_BytesAllocated, (Stats).BytesAllocated); (Stats).BytesAllocated = (Bytes); (Stats).PeakBytesAllocated = FMath::Max((Stats).PeakBytesAllocated, (Stats).BytesAllocated); INC_MEMORY_STAT_BY(STAT_YukiWFC_BytesAllocated, (Stats).BytesAllocated); } while (0)
+
+#else
+
+#define YUKI_WFC_SCOPE(Phase, Stats)
+#define YUKI_WFC_INC(Counter, Stats, Amount)
+#define YUKI_WFC_PEAK(Counter, Stats, Value)
+#define YUKI_WFC_SET_MEMORY(Stats, Bytes)
+
+#endif
@@ -0,0 +1,110 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/CircularQueue.h"
+#include "UObject/Object.h"
+#include <atomic>
+#include "YukiWaveFunctionCollapseStreamingSolver.generated.h"
+
+class UYukiWaveFunctionCollapseModel;
+class UYukiWaveFunctionCollapseSolver;
+
+USTRUCT(BlueprintType)
+struct FYukiWaveFunctionCollapseStreamedCell
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 Cell = INDEX_NONE;
+
+	/**
+	 * Compiled tile index the cell collapsed to.
+	 */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	int32 Tile = INDEX_NONE;
+};
+
+/**
+ * UYukiWaveFunctionCollapseStreamingSolver
+ *
+ * Solves on a worker thread and publishes cells as they collapse, so a container can spawn the finished
+ * parts of a large map while the rest is still solving. Cells are handed over in batches through a single
+ * producer, single consumer ring, the worker never waits on the game thread unless the ring is full.
+ * A contradiction restarts the solve, every cell published before is void and is published again.
+ */
+UCLASS(BlueprintType)
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API UYukiWaveFunctionCollapseStreamingSolver : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void BeginDestroy() override;
+
+	// Initializes a solver on the game thread and starts solving it on a worker. With a FocusCell, cells
+	// close to it collapse first, see UYukiWaveFunctionCollapseSolver::SetFocus.
+	UFUNCTION(BlueprintCallable)
+	void Start(UYukiWaveFunctionCollapseModel* InModel, FIntVector InSize, int32 InSeed, int32 FocusCell = -1, float FocusBias = 1.0f);
+
+	// Stops the worker and waits for it.
+	UFUNCTION(BlueprintCallable)
+	void Cancel();
+
+	// Moves up to MaxCells published cells into OutCells, in the order they collapsed. bOutRestarted is set
+	// when the worker restarted since the last call, cells received before are no longer valid.
+	void Poll(int MaxCells, TArray<FYukiWaveFunctionCollapseStreamedCell>& OutCells, bool& bOutRestarted);
+
+	// Returns true once the worker stopped and every published cell was polled.
+	UFUNCTION(BlueprintPure)
+	bool IsFinished() const;
+
+	// Returns true if the worker stopped with every cell collapsed.
+	UFUNCTION(BlueprintPure)
+	bool IsSolved() const { return bWorkerDone && bSolved; }
+
+	// Solver being solved, only safe to read once IsFinished.
+	UFUNCTION(BlueprintPure)
+	UYukiWaveFunctionCollapseSolver* GetSolver() const { return Solver; }
+
+	/**
+	 * Cells collected before a batch is published.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, meta = (ClampMin = 1))
+	int32 BatchSize = 64;
+
+	/**
+	 * Restarts after contradictions before the worker gives up, -1 for infinite.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
+	int32 MaxRestarts = 8;
+
+protected:
+	struct FBatch
+	{
+		TArray<FYukiWaveFunctionCollapseStreamedCell> Cells;
+		// Every cell of earlier batches is void.
+		bool bRestart = false;
+	};
+
+	void RunWorker();
+	// Hands the batch to the game thread and starts a new one, waiting while the ring is full. Returns false
+	// if cancelled meanwhile.
+	bool Publish(FBatch& Batch);
+
+	UPROPERTY()
+	TObjectPtr<UYukiWaveFunctionCollapseSolver> Solver;
+
+	TUniquePtr<TCircularQueue<FBatch>> Queue;
+	TFuture<void> Worker;
+	std::atomic<bool> bCancel = false;
+	std::atomic<bool> bWorkerDone = true;
+	std::atomic<bool> bSolved = false;
+	int32 Seed = 0;
+
+	// Cells dequeued on the game thread and not polled yet, from PendingHead.
+	TArray<FYukiWaveFunctionCollapseStreamedCell> Pending;
+	int PendingHead = 0;
+};
@@ -0,0 +1,234 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "YukiWaveFunctionCollapseTopology.generated.h"
+
+/**
+ * EYDWaveFunctionDirection
+ *
+ * Direction of the adjacency rule.
+ */
+UENUM(BlueprintType)
+enum class EYDWaveFunctionDirection
+{
+	XPlus UMETA(DisplayName = "X+ Right"),
+	XMinus UMETA(DisplayName = "X- Left"),
+	YPlus UMETA(DisplayName = "Y+ Forward"),
+	YMinus UMETA(DisplayName = "Y- Back"),
+	ZPlus UMETA(DisplayName = "Z+ Up"),
+	ZMinus UMETA(DisplayName = "Z- Down"),
+	HexNorthWest UMETA(DisplayName = "Hex NW"),
+	HexSouthEast UMETA(DisplayName = "Hex SE"),
+	MAX UMETA(Hidden)
+};
+
+/**
+ * EYukiWaveFunctionCollapseTopology
+ *
+ * Shape of the grid cells and which cells are neighbors.
+ */
+UENUM(BlueprintType)
+enum class EYukiWaveFunctionCollapseTopology : uint8
+{
+	Cube UMETA(ToolTip = "Boxes with six neighbors."),
+	CubeWrap UMETA(DisplayName = "Cube (Wrap X/Y)", ToolTip = "Boxes whose X and Y edges wrap around to the other side, for tiling textures and seamless levels."),
+	HexPrism UMETA(ToolTip = "Pointy top hexagons stacked in Z. Odd rows are shifted half a cell along X. Y+ is north east, Y- south west."),
+};
+
+// Grid topologies are compile time policies, so the solver instantiates its inner loops once per shape and
+// never branches on the shape per neighbor. Cells are always stored as Index = X + (Y * #X) + (Z * #X * #Y).
+// For example, a grid of 3 is laid out in this order:
+//0: [0, 1, 2], 1: [9,  10, 11], 2: [18, 19, 20]
+//   [3, 4, 5],    [12, 13, 14],	[21, 22, 23]
+//   [6, 7, 8]	   [15, 16, 17],	[24, 25, 26]
+//
+// Every policy provides:
+//   Directions       the directions a cell can have neighbors in.
+//   ForEachNeighbor  calls Func(Direction, NeighborIndex) for every neighbor inside the grid.
+//   GetLocation      center of a cell in cell units.
+//   GetOffset        shortest vector from one cell center to another in cell units.
+namespace YukiWaveFunctionCollapseTopology
+{
+	FORCEINLINE FIntVector GetCoordinates(const FIntVector& Size, int Index)
+	{
+		return FIntVector(Index % Size.X, (Index / Size.X) % Size.Y, Index / (Size.X * Size.Y));
+	}
+
+	template <typename TopologyType>
+	bool GetNeighbor(const FIntVector& Size, int Index, EYDWaveFunctionDirection Direction, int& OutNeighborIndex)
+	{
+		bool bFound = false;
+		TopologyType::ForEachNeighbor(Size, Index, [&](EYDWaveFunctionDirection NeighborDirection, int NeighborIndex)
+		{
+			if (NeighborDirection == Direction)
+			{
+				OutNeighborIndex = NeighborIndex;
+				bFound = true;
+			}
+		});
+		return bFound;
+	}
+}
+
+struct FYukiWaveFunctionCollapseCubeTopology
+{
+	static constexpr EYukiWaveFunctionCollapseTopology Type = EYukiWaveFunctionCollapseTopology::Cube;
+	static constexpr EYDWaveFunctionDirection Directions[] = {
+		EYDWaveFunctionDirection::XPlus, EYDWaveFunctionDirection::XMinus,
+		EYDWaveFunctionDirection::YPlus, EYDWaveFunctionDirection::YMinus,
+		EYDWaveFunctionDirection::ZPlus, EYDWaveFunctionDirection::ZMinus,
+	};
+
+	template <typename FuncType>
+	static FORCEINLINE void ForEachNeighbor(const FIntVector& Size, int Index, FuncType&& Func)
+	{
+		const FIntVector P = YukiWaveFunctionCollapseTopology::GetCoordinates(Size, Index);
+		const int Layer = Size.X * Size.Y;
+		if (P.X < Size.X - 1) { Func(EYDWaveFunctionDirection::XPlus, Index + 1); }
+		if (P.X > 0) { Func(EYDWaveFunctionDirection::XMinus, Index - 1); }
+		if (P.Y < Size.Y - 1) { Func(EYDWaveFunctionDirection::YPlus, Index + Size.X); }
+		if (P.Y > 0) { Func(EYDWaveFunctionDirection::YMinus, Index - Size.X); }
+		if (P.Z < Size.Z - 1) { Func(EYDWaveFunctionDirection::ZPlus, Index + Layer); }
+		if (P.Z > 0) { Func(EYDWaveFunctionDirection::ZMinus, Index - Layer); }
+	}
+
+	static FVector GetLocation(const FIntVector& Size, int Index)
+	{
+		return FVector(YukiWaveFunctionCollapseTopology::GetCoordinates(Size, Index));
+	}
+
+	static FVector GetOffset(const FIntVector& Size, int From, int To)
+	{
+		return GetLocation(Size, To) - GetLocation(Size, From);
+	}
+};
+
+// Cubes whose X and Y edges connect to the opposite side, Z keeps its borders.
+struct FYukiWaveFunctionCollapseWrapTopology
+{
+	static constexpr EYukiWaveFunctionCollapseTopology Type = EYukiWaveFunctionCollapseTopology::CubeWrap;
+	static constexpr EYDWaveFunctionDirection Directions[] = {
+		EYDWaveFunctionDirection::XPlus, EYDWaveFunctionDirection::XMinus,
+		EYDWaveFunctionDirection::YPlus, EYDWaveFunctionDirection::YMinus,
+		EYDWaveFunctionDirection::ZPlus, EYDWaveFunctionDirection::ZMinus,
+	};
+
+	template <typename FuncType>
+	static FORCEINLINE void ForEachNeighbor(const FIntVector& Size, int Index, FuncType&& Func)
+	{
+		const FIntVector P = YukiWaveFunctionCollapseTopology::GetCoordinates(Size, Index);
+		const int Row = Size.X;
+		const int Layer = Size.X * Size.Y;
+		Func(EYDWaveFunctionDirection::XPlus, P.X < Size.X - 1 ? Index + 1 : Index - (Size.X - 1));
+		Func(EYDWaveFunctionDirection::XMinus, P.X > 0 ? Index - 1 : Index + (Size.X - 1));
+		Func(EYDWaveFunctionDirection::YPlus, P.Y < Size.Y - 1 ? Index + Row : Index - (Layer - Row));
+		Func(EYDWaveFunctionDirection::YMinus, P.Y > 0 ? Index - Row : Index + (Layer - Row));
+		if (P.Z < Size.Z - 1) { Func(EYDWaveFunctionDirection::ZPlus, Index + Layer); }
+		if (P.Z > 0) { Func(EYDWaveFunctionDirection::ZMinus, Index - Layer); }
+	}
+
+	static FVector GetLocation(const FIntVector& Size, int Index)
+	{
+		return FVector(YukiWaveFunctionCollapseTopology::GetCoordinates(Size, Index));
+	}
+
+	static FVector GetOffset(const FIntVector& Size, int From, int To)
+	{
+		FIntVector Delta = YukiWaveFunctionCollapseTopology::GetCoordinates(Size, To) - YukiWaveFunctionCollapseTopology::GetCoordinates(Size, From);
+		// The short way around.
+		Delta.X += 2 * Delta.X > Size.X ? -Size.X : 2 * Delta.X < -Size.X ? Size.X : 0;
+		Delta.Y += 2 * Delta.Y > Size.Y ? -Size.Y : 2 * Delta.Y < -Size.Y ? Size.Y : 0;
+		return FVector(Delta);
+	}
+};
+
+// Pointy top hexagons in rows along X, odd rows shifted half a cell towards X+. X+/X- are east and west,
+// Y+/HexNorthWest the two cells in the next row, HexSouthEast/Y- the two in the previous row.
+struct FYukiWaveFunctionCollapseHexPrismTopology
+{
+	static constexpr EYukiWaveFunctionCollapseTopology Type = EYukiWaveFunctionCollapseTopology::HexPrism;
+	static constexpr EYDWaveFunctionDirection Directions[] = {
+		EYDWaveFunctionDirection::XPlus, EYDWaveFunctionDirection::XMinus,
+		EYDWaveFunctionDirection::YPlus, EYDWaveFunctionDirection::YMinus,
+		EYDWaveFunctionDirection::HexNorthWest, EYDWaveFunctionDirection::HexSouthEast,
+		EYDWaveFunctionDirection::ZPlus, EYDWaveFunctionDirection::ZMinus,
+	};
+
+	// Distance between rows, for hexagons one cell wide across the flats.
+	static constexpr float RowHeight = 0.8660254f;
+
+	template <typename FuncType>
+	static FORCEINLINE void ForEachNeighbor(const FIntVector& Size, int Index, FuncType&& Func)
+	{
+		const FIntVector P = YukiWaveFunctionCollapseTopology::GetCoordinates(Size, Index);
+		const int Layer = Size.X * Size.Y;
+		// Cells of the rows above and below at X + Shift and X + Shift - 1.
+		const int Shift = P.Y & 1;
+		if (P.X < Size.X - 1) { Func(EYDWaveFunctionDirection::XPlus, Index + 1); }
+		if (P.X > 0) { Func(EYDWaveFunctionDirection::XMinus, Index - 1); }
+		if (P.Y < Size.Y - 1)
+		{
+			if (P.X + Shift < Size.X) { Func(EYDWaveFunctionDirection::YPlus, Index + Size.X + Shift); }
+			if (P.X + Shift > 0) { Func(EYDWaveFunctionDirection::HexNorthWest, Index + Size.X + Shift - 1); }
+		}
+		if (P.Y > 0)
+		{
+			if (P.X + Shift < Size.X) { Func(EYDWaveFunctionDirection::HexSouthEast, Index - Size.X + Shift); }
+			if (P.X + Shift > 0) { Func(EYDWaveFunctionDirection::YMinus, Index - Size.X + Shift - 1); }
+		}
+		if (P.Z < Size.Z - 1) { Func(EYDWaveFunctionDirection::ZPlus, Index + Layer); }
+		if (P.Z > 0) { Func(EYDWaveFunctionDirection::ZMinus, Index - Layer); }
+	}
+
+	static FVector GetLocation(const FIntVector& Size, int Index)
+	{
+		const FIntVector P = YukiWaveFunctionCollapseTopology::GetCoordinates(Size, Index);
+		return FVector(P.X + 0.5f * (P.Y & 1), P.Y * RowHeight, P.Z);
+	}
+
+	static FVector GetOffset(const FIntVector& Size, int From, int To)
+	{
+		return GetLocation(Size, To) - GetLocation(Size, From);
+	}
+};
+
+// Calls Func with a default constructed policy of the topology. Dispatch once outside of hot loops and
+// run the loop inside Func, templated on the policy.
+template <typename FuncType>
+decltype(auto) VisitTopology(EYukiWaveFunctionCollapseTopology Topology, FuncType&& Func)
+{
+	switch (Topology)
+	{
+		case EYukiWaveFunctionCollapseTopology::CubeWrap:
+			return Func(FYukiWaveFunctionCollapseWrapTopology());
+		case EYukiWaveFunctionCollapseTopology::HexPrism:
+			return Func(FYukiWaveFunctionCollapseHexPrismTopology());
+		default:
+			return Func(FYukiWaveFunctionCollapseCubeTopology());
+	}
+}
+
+// Runtime dispatched versions of the policies, for code outside of the solver's inner loops.
+inline TConstArrayView<EYDWaveFunctionDirection> GetTopologyDirections(EYukiWaveFunctionCollapseTopology Topology)
+{
+	return VisitTopology(Topology, [](auto Policy) { return TConstArrayView<EYDWaveFunctionDirection>(decltype(Policy)::Directions); });
+}
+
+inline bool GetNeighborCell(EYukiWaveFunctionCollapseTopology Topology, const FIntVector& Size, int Index, EYDWaveFunctionDirection Direction, int& OutNeighborIndex)
+{
+	return VisitTopology(Topology, [&](auto Policy) { return YukiWaveFunctionCollapseTopology::GetNeighbor<decltype(Policy)>(Size, Index, Direction, OutNeighborIndex); });
+}
+
+// Center of a cell in cell units.
+inline FVector GetCellLocation(EYukiWaveFunctionCollapseTopology Topology, const FIntVector& Size, int Index)
+{
+	return VisitTopology(Topology, [&](auto Policy) { return decltype(Policy)::GetLocation(Size, Index); });
+}
+
+// Shortest vector between two cell centers in cell units, across the seams of wrapping grids.
+inline FVector GetCellOffset(EYukiWaveFunctionCollapseTopology Topology, const FIntVector& Size, int From, int To)
+{
+	return VisitTopology(Topology, [&](auto Policy) { return decltype(Policy)::GetOffset(Size, From, To); });
+}
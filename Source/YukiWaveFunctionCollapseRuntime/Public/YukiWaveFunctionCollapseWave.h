@@ -0,0 +1,288 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+/**
+ * FYukiWaveFunctionCollapseWave
+ *
+ * Option state of every cell, indexed by the compiled model's tile indices. Most cells are either fully
+ * open or collapsed, so every cell is a single word in one of four states:
+ *
+ *   AllOptions     every tile is possible, no storage.
+ *   NoOptions      contradiction, no storage.
+ *   Partial        index of a NumWords bitset slot in a pool that recycles freed slots.
+ *   otherwise      the collapsed tile index.
+ *
+ * Cells move between states on every write, so only partially constrained cells pay for a bitset.
+ */
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseWave
+{
+public:
+	// Sets every cell to AllMask.
+	void Init(int InNumCells, int InNumWords, const uint64* AllMask, int InNumTiles);
+
+	int Num() const { return NumCells; }
+
+	int GetCount(int Cell) const
+	{
+		const uint32 State = States[Cell];
+		if (State == AllOptions)
+		{
+			return NumTiles;
+		}
+		if (State == NoOptions)
+		{
+			return 0;
+		}
+		return State & PartialBit ? PoolCounts[State & ~PartialBit] : 1;
+	}
+
+	// Options of a cell as NumWords words. Partial cells point into the pool, so the pointer is only
+	// valid until the next write to the wave.
+	const uint64* GetMask(int Cell) const
+	{
+		const uint32 State = States[Cell];
+		if (State & PartialBit)
+		{
+			return State == AllOptions ? Masks->GetAll() : State == NoOptions ? Masks->GetNone() : PoolBits.GetData() + (State & ~PartialBit) * NumWords;
+		}
+		return Masks->GetSingle(State);
+	}
+
+	bool Has(int Cell, int Tile) const
+	{
+		const uint32 State = States[Cell];
+		if (!(State & PartialBit))
+		{
+			return State == (uint32) Tile;
+		}
+		return (GetMask(Cell)[Tile / 64] & (1ull << (Tile % 64))) != 0;
+	}
+
+	// Returns true if the cell shares any tile with Mask.
+	bool HasAny(int Cell, const uint64* Mask) const
+	{
+		const uint64* CellMask = GetMask(Cell);
+		for (int Word = 0; Word < NumWords; Word++)
+		{
+			if (CellMask[Word] & Mask[Word])
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Replaces the options of a cell. Count is the number of bits set in Mask.
+	void SetMask(int Cell, const uint64* Mask, int Count);
+
+	// Removes every option not in Mask. Returns the number of options removed.
+	int Intersect(int Cell, const uint64* Mask);
+
+	// Removes a single option. Returns true if it was present.
+	bool Remove(int Cell, int Tile);
+
+	// Leaves Tile as the only option of a cell.
+	void Collapse(int Cell, int Tile)
+	{
+		ReleaseSlot(Cell);
+		States[Cell] = (uint32) Tile;
+	}
+
+	// Returns the lowest tile index still possible in a cell, or INDEX_NONE if it has no options.
+	int GetFirstTile(int Cell) const
+	{
+		const uint32 State = States[Cell];
+		if (!(State & PartialBit))
+		{
+			return (int) State;
+		}
+		if (State == NoOptions)
+		{
+			return INDEX_NONE;
+		}
+		const uint64* CellMask = GetMask(Cell);
+		for (int Word = 0; Word < NumWords; Word++)
+		{
+			if (CellMask[Word])
+			{
+				return Word * 64 + (int) FMath::CountTrailingZeros64(CellMask[Word]);
+			}
+		}
+		return INDEX_NONE;
+	}
+
+	// Calls Func(Tile) for every option of a cell, in tile order.
+	template <typename FuncType>
+	void ForEachTile(int Cell, FuncType&& Func) const
+	{
+		const uint32 State = States[Cell];
+		if (!(State & PartialBit))
+		{
+			Func((int) State);
+			return;
+		}
+		const uint64* CellMask = GetMask(Cell);
+		for (int Word = 0; Word < NumWords; Word++)
+		{
+			uint64 WordBits = CellMask[Word];
+			while (WordBits)
+			{
+				Func(Word * 64 + (int) FMath::CountTrailingZeros64(WordBits));
+				WordBits &= WordBits - 1;
+			}
+		}
+	}
+
+	// Bytes owned by this wave. The mask table is shared between copies and not included.
+	SIZE_T GetAllocatedSize() const
+	{
+		return States.GetAllocatedSize() + PoolBits.GetAllocatedSize() + PoolCounts.GetAllocatedSize() + FreeSlots.GetAllocatedSize();
+	}
+
+	// Number of cells currently holding a pooled bitset.
+	int NumPartialCells() const { return PoolCounts.Num() - FreeSlots.Num(); }
+
+	int NumCells = 0;
+	int NumWords = 0;
+	int NumTiles = 0;
+
+private:
+	static constexpr uint32 PartialBit = 1u << 31;
+	static constexpr uint32 AllOptions = MAX_uint32;
+	static constexpr uint32 NoOptions = MAX_uint32 - 1;
+
+	// Read-only masks for the states without a slot: one row per collapsed tile, then all and none.
+	struct FMaskTable
+	{
+		int NumWords = 0;
+		int NumTiles = 0;
+		TArray<uint64> Rows;
+
+		const uint64* GetSingle(uint32 Tile) const { return Rows.GetData() + Tile * NumWords; }
+		const uint64* GetAll() const { return Rows.GetData() + NumTiles * NumWords; }
+		const uint64* GetNone() const { return Rows.GetData() + (NumTiles + 1) * NumWords; }
+	};
+
+	// Moves a cell into the state matching Mask, reusing its slot if it already has one.
+	void Store(int Cell, const uint64* Mask, int Count);
+	void ReleaseSlot(int Cell);
+	uint32 AllocateSlot();
+
+	TArray<uint32> States;
+	TArray<uint64> PoolBits;
+	TArray<uint16> PoolCounts;
+	TArray<uint32> FreeSlots;
+	TSharedPtr<const FMaskTable> Masks;
+};
+
+/**
+ * FYukiWaveFunctionCollapseTileIndex
+ *
+ * Inverted index from tile to the cells collapsed to it. Every tile keeps an unordered list of cells and
+ * every cell its position in that list, so adding and removing a cell is O(1) and queries read the lists
+ * in place.
+ */
+struct YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseTileIndex
+{
+public:
+	void Init(int NumCells, int NumTiles)
+	{
+		Cells.SetNum(NumTiles);
+		for (TArray<int>& TileCells : Cells)
+		{
+			TileCells.Reset();
+		}
+		Slots.Init(INDEX_NONE, NumCells);
+	}
+
+	void Add(int Cell, int Tile)
+	{
+		check(Slots[Cell] == INDEX_NONE);
+		Slots[Cell] = Cells[Tile].Add(Cell);
+	}
+
+	void Remove(int Cell, int Tile)
+	{
+		TArray<int>& TileCells = Cells[Tile];
+		const int Slot = Slots[Cell];
+		check(TileCells[Slot] == Cell);
+		const int Last = TileCells.Pop(false);
+		if (Last != Cell)
+		{
+			TileCells[Slot] = Last;
+			Slots[Last] = Slot;
+		}
+		Slots[Cell] = INDEX_NONE;
+	}
+
+	int Num(int Tile) const { return Cells[Tile].Num(); }
+
+	// Cells collapsed to a tile, in no particular order. Invalidated by the next change to the index.
+	TConstArrayView<int> GetCells(int Tile) const { return Cells[Tile]; }
+
+	SIZE_T GetAllocatedSize() const
+	{
+		SIZE_T Bytes = Cells.GetAllocatedSize() + Slots.GetAllocatedSize();
+		for (const TArray<int>& TileCells : Cells)
+		{
+			Bytes += TileCells.GetAllocatedSize();
+		}
+		return Bytes;
+	}
+
+private:
+	TArray<TArray<int>> Cells;
+	TArray<int> Slots;
+};
+
+/**
+ * Wave after the model borders have been applied and propagated. Identical for every seed, so it is
+ * built once per (rules, size) and shared read-only between solvers.
+ */
+struct FYukiWaveFunctionCollapseInitialState
+{
+	FYukiWaveFunctionCollapseWave Wave;
+	FYukiWaveFunctionCollapseTileIndex CollapsedCells;
+	int NumCollapsedCells = 0;
+	bool bContradiction = false;
+};
+
+/**
+ * Shares initial states between solvers, keyed by the compiled model content hash and the grid size.
+ * Safe to use from any thread. Holds at most MaxBytes of waves, evicting the least recently used state;
+ * solvers keep the states they use alive.
+ */
+class YUKIWAVEFUNCTIONCOLLAPSERUNTIME_API FYukiWaveFunctionCollapseInitialStateCache
+{
+public:
+	static FYukiWaveFunctionCollapseInitialStateCache& Get();
+
+	TSharedPtr<const FYukiWaveFunctionCollapseInitialState> Find(uint64 ContentHash, const FIntVector& Size);
+	// Returns the cached state, which is the one already there if another thread built the same state first.
+	TSharedPtr<const FYukiWaveFunctionCollapseInitialState> Add(uint64 ContentHash, const FIntVector& Size, TSharedPtr<const FYukiWaveFunctionCollapseInitialState> State);
+	void Empty();
+
+	void SetMaxBytes(SIZE_T InMaxBytes);
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	struct FEntry
+	{
+		TSharedPtr<const FYukiWaveFunctionCollapseInitialState> State;
+		SIZE_T Bytes = 0;
+		uint64 LastUse = 0;
+	};
+
+	// Drops the least recently used states until the cache fits, keeping at least one.
+	void Trim();
+
+	mutable FCriticalSection Lock;
+	TMap<TTuple<uint64, FIntVector>, FEntry> States;
+	SIZE_T TotalBytes = 0;
+	SIZE_T MaxBytes = 64 * 1024 * 1024;
+	uint64 UseCounter = 0;
+};
@@ -34,6 +34,9 @@ public class YukiWaveFunctionCollapseRuntime : ModuleRules
 				"Slate",
 				"SlateCore",
 				"GameplayTags",
+				"MeshDescription",
+				"NavigationSystem",
+				"StaticMeshDescription",
 				"UnrealEd",
 				// ... add private dependencies that you statically link with here ...	
 			}